@@ -0,0 +1,389 @@
+// CommandList, part of Shader.hpp (included by it)
+// in the implementation file:
+
+// #define SHADER_IMPLEMENTATION
+// #include "glad.h" or "glew.h" or ...
+// #include "CommandList.hpp"
+
+#pragma once
+
+#include "MeshBuffer.hpp"
+
+namespace sh
+{
+
+// frame commands recorded on any thread and replayed in order on the GL thread:
+//
+// std::vector<sh::CommandList> lists(pool.getThreadCount());
+//
+// for(std::size_t i = 0; i < lists.size(); ++i)
+//     pool.submit([&, i] {lists[i].clear(); recordPart(i, lists[i]);});
+//
+// pool.wait();
+//
+// for(auto& list: lists)
+//     list.replay();
+//
+// commands are packed PODs, recording makes no GL calls and does not read the shaders,
+// meshes and buffers it references (they must outlive the replay), a list is recorded by
+// one thread at a time
+// replay binds shaders with Shader::bind() (hot reload, variant switch and TypedShader
+// validation happen there) and sets uniforms on the active program of the shader they
+// were recorded with, bound or not
+class CommandList
+{
+public:
+    // keeps the capacity
+    void clear() {data_.clear();}
+
+    bool empty() const {return data_.empty();}
+    std::size_t getByteCount() const {return data_.size();}
+
+    void bind(Shader& shader);
+
+    // location from TypedShader::getLocation() during the replay
+    template<typename Uniform, typename... Uniforms>
+    void set(TypedShader<Uniforms...>& shader, const typename Uniform::Type& value)
+    {
+        using Type = typename Uniform::Type;
+
+        recordUniform(shader, &getTypedLocation<TypedShader<Uniforms...>, Uniform>, -1,
+                      UniformType<Type>::value, &value, sizeof(value));
+    }
+
+    // location from shader.getUniformLocation() on the GL thread, T as in SH_UNIFORM()
+    template<typename T>
+    void setUniform(Shader& shader, GLint location, const T& value)
+    {
+        recordUniform(shader, nullptr, location, UniformType<T>::value, &value,
+                      sizeof(value));
+    }
+
+    void bindVertexArray(GLuint vertexArray);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bind(const MeshBuffer& meshBuffer);
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount = 1);
+
+    // see MeshBuffer::draw()
+    void draw(const MeshBuffer& meshBuffer, const MeshBuffer::Mesh& mesh,
+              GLsizei instanceCount = 1);
+
+    // GL_TRIANGLES with GL_UNSIGNED_INT indices, DrawElementsIndirectCommand array in
+    // the buffer bound to GL_DRAW_INDIRECT_BUFFER
+    void multiDrawElementsIndirect(std::size_t offset, GLsizei drawCount);
+
+    // see Shader::dispatch(), shader must be bound before it in the list
+    void dispatch(Shader& shader, GLuint sizeX, GLuint sizeY = 1, GLuint sizeZ = 1);
+
+    void replay() const;
+
+private:
+    std::vector<char> data_;
+
+    // command and data are packed after a header, padded to 8 bytes
+    void record(std::uint32_t type, const void* command, std::size_t size,
+                const void* data = nullptr, std::size_t dataSize = 0);
+
+    void recordUniform(Shader& shader, GLint (*getLocation)(const Shader&), GLint location,
+                       GLenum type, const void* value, std::size_t size);
+
+    template<typename Typed, typename Uniform>
+    static GLint getTypedLocation(const Shader& shader)
+    {
+        return static_cast<const Typed&>(shader).template getLocation<Uniform>();
+    }
+};
+
+} // namespace sh
+
+#ifdef SHADER_IMPLEMENTATION
+
+namespace sh
+{
+
+enum CommandType: std::uint32_t
+{
+    BindCommandType,
+    UniformCommandType,
+    VertexArrayCommandType,
+    BufferCommandType,
+    BufferBaseCommandType,
+    MeshBufferCommandType,
+    DrawArraysCommandType,
+    DrawMeshCommandType,
+    MultiDrawCommandType,
+    DispatchCommandType
+};
+
+struct CommandHeader
+{
+    std::uint32_t type;
+    std::uint32_t size; // with the header and padding
+};
+
+struct BindCommand
+{
+    Shader* shader;
+};
+
+// followed by the value
+struct UniformCommand
+{
+    Shader* shader;
+    GLint (*getLocation)(const Shader&); // TypedShader, nullptr: location
+    GLint location;
+    GLenum type;
+};
+
+struct BufferCommand
+{
+    GLenum target;
+    GLuint index; // bindBufferBase()
+    GLuint buffer;
+};
+
+struct DrawArraysCommand
+{
+    GLenum mode;
+    GLint first;
+    GLsizei count;
+    GLsizei instanceCount;
+};
+
+struct DrawMeshCommand
+{
+    const MeshBuffer* meshBuffer;
+    MeshBuffer::Mesh mesh;
+    GLsizei instanceCount;
+};
+
+struct MultiDrawCommand
+{
+    std::size_t offset;
+    GLsizei drawCount;
+};
+
+struct DispatchCommand
+{
+    Shader* shader;
+    GLuint size[3];
+};
+
+void CommandList::record(std::uint32_t type, const void* command, std::size_t size,
+                         const void* data, std::size_t dataSize)
+{
+    auto payloadSize = (size + dataSize + 7) / 8 * 8;
+    CommandHeader header{type, static_cast<std::uint32_t>(sizeof(header) + payloadSize)};
+
+    auto offset = data_.size();
+    data_.resize(offset + header.size);
+    std::memcpy(&data_[offset], &header, sizeof(header));
+    std::memcpy(&data_[offset + sizeof(header)], command, size);
+
+    if(dataSize)
+        std::memcpy(&data_[offset + sizeof(header) + size], data, dataSize);
+}
+
+void CommandList::bind(Shader& shader)
+{
+    BindCommand command{&shader};
+    record(BindCommandType, &command, sizeof(command));
+}
+
+void CommandList::recordUniform(Shader& shader, GLint (*getLocation)(const Shader&),
+                                GLint location, GLenum type, const void* value,
+                                std::size_t size)
+{
+    UniformCommand command{&shader, getLocation, location, type};
+    record(UniformCommandType, &command, sizeof(command), value, size);
+}
+
+void CommandList::bindVertexArray(GLuint vertexArray)
+{
+    BufferCommand command{0, 0, vertexArray};
+    record(VertexArrayCommandType, &command, sizeof(command));
+}
+
+void CommandList::bindBuffer(GLenum target, GLuint buffer)
+{
+    BufferCommand command{target, 0, buffer};
+    record(BufferCommandType, &command, sizeof(command));
+}
+
+void CommandList::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    BufferCommand command{target, index, buffer};
+    record(BufferBaseCommandType, &command, sizeof(command));
+}
+
+void CommandList::bind(const MeshBuffer& meshBuffer)
+{
+    DrawMeshCommand command{&meshBuffer, {}, 0};
+    record(MeshBufferCommandType, &command, sizeof(command));
+}
+
+void CommandList::drawArrays(GLenum mode, GLint first, GLsizei count,
+                             GLsizei instanceCount)
+{
+    DrawArraysCommand command{mode, first, count, instanceCount};
+    record(DrawArraysCommandType, &command, sizeof(command));
+}
+
+void CommandList::draw(const MeshBuffer& meshBuffer, const MeshBuffer::Mesh& mesh,
+                       GLsizei instanceCount)
+{
+    DrawMeshCommand command{&meshBuffer, mesh, instanceCount};
+    record(DrawMeshCommandType, &command, sizeof(command));
+}
+
+void CommandList::multiDrawElementsIndirect(std::size_t offset, GLsizei drawCount)
+{
+    MultiDrawCommand command{offset, drawCount};
+    record(MultiDrawCommandType, &command, sizeof(command));
+}
+
+void CommandList::dispatch(Shader& shader, GLuint sizeX, GLuint sizeY, GLuint sizeZ)
+{
+    DispatchCommand command{&shader, {sizeX, sizeY, sizeZ}};
+    record(DispatchCommandType, &command, sizeof(command));
+}
+
+// value as recorded by CommandList, type as in UniformType
+void setUniformValue(GLuint program, GLint location, GLenum type, const char* value)
+{
+    auto* f = reinterpret_cast<const GLfloat*>(value);
+    auto* i = reinterpret_cast<const GLint*>(value);
+    auto* u = reinterpret_cast<const GLuint*>(value);
+
+    switch(type)
+    {
+        case GL_FLOAT:             glProgramUniform1fv(program, location, 1, f); break;
+        case GL_FLOAT_VEC2:        glProgramUniform2fv(program, location, 1, f); break;
+        case GL_FLOAT_VEC3:        glProgramUniform3fv(program, location, 1, f); break;
+        case GL_FLOAT_VEC4:        glProgramUniform4fv(program, location, 1, f); break;
+        case GL_INT:               glProgramUniform1iv(program, location, 1, i); break;
+        case GL_INT_VEC2:          glProgramUniform2iv(program, location, 1, i); break;
+        case GL_INT_VEC3:          glProgramUniform3iv(program, location, 1, i); break;
+        case GL_INT_VEC4:          glProgramUniform4iv(program, location, 1, i); break;
+        case GL_UNSIGNED_INT:      glProgramUniform1uiv(program, location, 1, u); break;
+        case GL_UNSIGNED_INT_VEC2: glProgramUniform2uiv(program, location, 1, u); break;
+        case GL_UNSIGNED_INT_VEC3: glProgramUniform3uiv(program, location, 1, u); break;
+        case GL_UNSIGNED_INT_VEC4: glProgramUniform4uiv(program, location, 1, u); break;
+        case GL_BOOL:              glProgramUniform1i(program, location, *value); break;
+
+        case GL_FLOAT_MAT2:
+            glProgramUniformMatrix2fv(program, location, 1, GL_FALSE, f);
+            break;
+
+        case GL_FLOAT_MAT3:
+            glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, f);
+            break;
+
+        case GL_FLOAT_MAT4:
+            glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, f);
+            break;
+    }
+}
+
+void CommandList::replay() const
+{
+    SH_TRACE_SCOPE("replay", {});
+    std::size_t offset = 0;
+
+    while(offset < data_.size())
+    {
+        CommandHeader header;
+        std::memcpy(&header, &data_[offset], sizeof(header));
+        auto* payload = &data_[offset + sizeof(header)];
+        offset += header.size;
+
+        switch(header.type)
+        {
+            case BindCommandType:
+            {
+                BindCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+                command.shader->bind();
+                break;
+            }
+            case UniformCommandType:
+            {
+                UniformCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+
+                auto location = command.location;
+
+                if(command.getLocation)
+                    location = command.getLocation(*command.shader);
+
+                if(countUniformSet(location))
+                {
+                    setUniformValue(command.shader->getActiveProgramId(), location,
+                                    command.type, payload + sizeof(command));
+                }
+
+                break;
+            }
+            case VertexArrayCommandType:
+            case BufferCommandType:
+            case BufferBaseCommandType:
+            {
+                BufferCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+
+                if(header.type == VertexArrayCommandType)
+                    glBindVertexArray(command.buffer);
+                else if(header.type == BufferCommandType)
+                    glBindBuffer(command.target, command.buffer);
+                else
+                    glBindBufferBase(command.target, command.index, command.buffer);
+
+                break;
+            }
+            case MeshBufferCommandType:
+            case DrawMeshCommandType:
+            {
+                DrawMeshCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+
+                if(header.type == MeshBufferCommandType)
+                    command.meshBuffer->bind();
+                else
+                    command.meshBuffer->draw(command.mesh, command.instanceCount);
+
+                break;
+            }
+            case DrawArraysCommandType:
+            {
+                DrawArraysCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+                glDrawArraysInstanced(command.mode, command.first, command.count,
+                                      command.instanceCount);
+                break;
+            }
+            case MultiDrawCommandType:
+            {
+                MultiDrawCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                            reinterpret_cast<const void*>(command.offset),
+                                            command.drawCount, 0);
+                break;
+            }
+            case DispatchCommandType:
+            {
+                DispatchCommand command;
+                std::memcpy(&command, payload, sizeof(command));
+                command.shader->dispatch(command.size[0], command.size[1],
+                                         command.size[2]);
+                break;
+            }
+        }
+    }
+}
+
+} // namespace sh
+
+#endif // SHADER_IMPLEMENTATION
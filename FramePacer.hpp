@@ -0,0 +1,156 @@
+// FramePacer, part of Shader.hpp (included by it)
+// in the implementation file:
+
+// #define SHADER_IMPLEMENTATION
+// #include "glad.h" or "glew.h" or ...
+// #include "FramePacer.hpp"
+
+#pragma once
+
+#include "Shader.hpp"
+
+namespace sh
+{
+
+// caps the number of frames queued on the gpu with one fence per frame
+//
+// pacer.beginFrame(); // before polling input, may block
+// ...
+// glfwSwapBuffers(window); // skip when headless
+// pacer.endFrame();
+//
+class FramePacer
+{
+public:
+    struct Stats
+    {
+        std::size_t frameCount = 0;
+        int framesInFlight = 0;
+        double waitMs = 0; // cpu time blocked in the last beginFrame()
+        double avgWaitMs = 0;
+        double maxWaitMs = 0;
+        double latencyMs = 0; // from endFrame() until the frame was seen completed
+        double avgLatencyMs = 0;
+        double maxLatencyMs = 0;
+    };
+
+    FramePacer(int maxFramesInFlight = 2);
+    ~FramePacer();
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    void setMaxFramesInFlight(int count) {maxFramesInFlight_ = std::max(count, 1);}
+
+    // at most one frame in flight and commands are flushed right after endFrame()
+    void setLowLatency(bool on) {lowLatency_ = on;}
+
+    void beginFrame();
+    void endFrame();
+
+    const Stats& getStats() const {return stats_;}
+    void resetStats();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Frame
+    {
+        GLsync fence;
+        Clock::time_point endTime;
+    };
+
+    int maxFramesInFlight_;
+    bool lowLatency_ = false;
+    std::deque<Frame> frames_;
+    Stats stats_;
+    std::size_t completedCount_ = 0;
+    double waitSumMs_ = 0;
+    double latencySumMs_ = 0;
+
+    // returns false if timed out
+    bool retireFrame(bool wait);
+};
+
+} // namespace sh
+
+#ifdef SHADER_IMPLEMENTATION
+
+namespace sh
+{
+
+FramePacer::FramePacer(int maxFramesInFlight):
+    maxFramesInFlight_(std::max(maxFramesInFlight, 1))
+{}
+
+FramePacer::~FramePacer()
+{
+    for(auto& frame: frames_)
+        glDeleteSync(frame.fence);
+}
+
+bool FramePacer::retireFrame(bool wait)
+{
+    auto& frame = frames_.front();
+
+    auto status = glClientWaitSync(frame.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                   wait ? GL_TIMEOUT_IGNORED : 0);
+
+    if(status == GL_TIMEOUT_EXPIRED)
+        return false;
+
+    if(status == GL_WAIT_FAILED)
+        std::cout << "sh::FramePacer: glClientWaitSync() failed" << std::endl;
+
+    std::chrono::duration<double, std::milli> latency = Clock::now() - frame.endTime;
+
+    ++completedCount_;
+    latencySumMs_ += latency.count();
+    stats_.latencyMs = latency.count();
+    stats_.avgLatencyMs = latencySumMs_ / completedCount_;
+    stats_.maxLatencyMs = std::max(stats_.maxLatencyMs, latency.count());
+
+    glDeleteSync(frame.fence);
+    frames_.pop_front();
+    return true;
+}
+
+void FramePacer::beginFrame()
+{
+    while(frames_.size() && retireFrame(false))
+        ;
+
+    auto maxFramesInFlight = lowLatency_ ? 1 : maxFramesInFlight_;
+    auto start = Clock::now();
+
+    while(static_cast<int>(frames_.size()) >= maxFramesInFlight)
+        retireFrame(true);
+
+    std::chrono::duration<double, std::milli> wait = Clock::now() - start;
+
+    ++stats_.frameCount;
+    waitSumMs_ += wait.count();
+    stats_.waitMs = wait.count();
+    stats_.avgWaitMs = waitSumMs_ / stats_.frameCount;
+    stats_.maxWaitMs = std::max(stats_.maxWaitMs, wait.count());
+    stats_.framesInFlight = frames_.size();
+}
+
+void FramePacer::resetStats()
+{
+    stats_ = {};
+    completedCount_ = 0;
+    waitSumMs_ = 0;
+    latencySumMs_ = 0;
+}
+
+void FramePacer::endFrame()
+{
+    frames_.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), Clock::now()});
+
+    if(lowLatency_)
+        glFlush();
+}
+
+} // namespace sh
+
+#endif // SHADER_IMPLEMENTATION
@@ -0,0 +1,249 @@
+// GpuCuller, part of Shader.hpp (included by it)
+// in the implementation file:
+
+// #define SHADER_IMPLEMENTATION
+// #include "glad.h" or "glew.h" or ...
+// #include "GpuCuller.hpp"
+
+#pragma once
+
+#include "MeshBuffer.hpp"
+
+namespace sh
+{
+
+// planes (a, b, c, d) of the view frustum, normalized, pointing inside
+// mvp is a column-major 4x4 matrix (linmath.h mat4x4)
+void extractFrustumPlanes(const float* mvp, float (&planes)[6][4]);
+
+// frustum culling of instance bounding spheres with a compute shader (GL 4.3)
+//
+// each instance belongs to one draw command, visible instances of command i are
+// compacted into visibleIds[commands[i].baseInstance + n], n < commands[i].instanceCount
+// baseInstance ranges must be reserved by the user, instanceCount is overwritten
+// instances with drawId >= commandCount are skipped, ids that don't fit in visibleIds
+// are dropped and instanceCount is clamped to the ids written
+//
+// use visibleIds as an instanced vertex attribute (divisor 1) and draw with
+// glMultiDrawElementsIndirect(), the attribute then yields the visible instance id
+//
+class GpuCuller
+{
+public:
+    // std430 layout of the instance buffer elements
+    struct Instance
+    {
+        float center[3];
+        float radius;
+        GLuint drawId;
+        GLuint padding[3];
+    };
+
+    GpuCuller();
+
+    bool isValid() const {return cullShader_.isValid() && resetShader_.isValid();}
+
+    // buffers: instanceBuffer - Instance[instanceCount]
+    //          commandBuffer - DrawElementsIndirectCommand[commandCount]
+    //          visibleIdBuffer - GLuint[instanceCount] (the size of the buffer bound
+    //                            is the capacity)
+    void cull(const float (&planes)[6][4], GLuint instanceBuffer, GLuint instanceCount,
+              GLuint commandBuffer, GLuint commandCount, GLuint visibleIdBuffer);
+
+private:
+    Shader cullShader_;
+    Shader resetShader_;
+};
+
+// cpu reference of GpuCuller::cull()
+// visible ids of each command are written in ascending order (gpu order is unspecified)
+void cullInstances(const float (&planes)[6][4], const GpuCuller::Instance* instances,
+                   GLuint instanceCount, DrawElementsIndirectCommand* commands,
+                   GLuint commandCount, GLuint* visibleIds, GLuint visibleIdCount);
+
+} // namespace sh
+
+#ifdef SHADER_IMPLEMENTATION
+
+#include <cmath>
+
+namespace sh
+{
+
+void extractFrustumPlanes(const float* mvp, float (&planes)[6][4])
+{
+    for(int i = 0; i < 6; ++i)
+    {
+        auto row = i / 2;
+        auto sign = i % 2 ? -1.f : 1.f;
+
+        for(int col = 0; col < 4; ++col)
+            planes[i][col] = mvp[col * 4 + 3] + sign * mvp[col * 4 + row];
+
+        auto length = std::sqrt(planes[i][0] * planes[i][0] +
+                                planes[i][1] * planes[i][1] +
+                                planes[i][2] * planes[i][2]);
+
+        for(auto& value: planes[i])
+            value /= length;
+    }
+}
+
+static const char* const cullShaderSource = R"(
+COMPUTE
+#version 430
+layout(local_size_x = 64) in;
+
+struct Instance
+{
+    vec4 sphere;
+    uint drawId;
+};
+
+struct Command
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {Instance instances[];};
+layout(std430, binding = 1) buffer Commands {Command commands[];};
+layout(std430, binding = 2) writeonly buffer VisibleIds {uint visibleIds[];};
+
+uniform vec4 planes[6];
+uniform uint instanceCount;
+uniform uint commandCount;
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+
+    if(id >= instanceCount)
+        return;
+
+    Instance instance = instances[id];
+
+    if(instance.drawId >= commandCount)
+        return;
+
+    for(int i = 0; i < 6; ++i)
+    {
+        if(dot(planes[i].xyz, instance.sphere.xyz) + planes[i].w < -instance.sphere.w)
+            return;
+    }
+
+    uint capacity = uint(visibleIds.length());
+    uint baseInstance = commands[instance.drawId].baseInstance;
+    uint slot = atomicAdd(commands[instance.drawId].instanceCount, 1u);
+
+    if(baseInstance < capacity && slot < capacity - baseInstance)
+    {
+        visibleIds[baseInstance + slot] = id;
+        return;
+    }
+
+    // every overflowing add is followed by its clamp, so the last one leaves the count
+    // at the ids written
+    atomicMin(commands[instance.drawId].instanceCount,
+              capacity - min(baseInstance, capacity));
+}
+)";
+
+static const char* const resetShaderSource = R"(
+COMPUTE
+#version 430
+layout(local_size_x = 64) in;
+
+struct Command
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 1) buffer Commands {Command commands[];};
+
+uniform uint commandCount;
+
+void main()
+{
+    if(gl_GlobalInvocationID.x < commandCount)
+        commands[gl_GlobalInvocationID.x].instanceCount = 0u;
+}
+)";
+
+GpuCuller::GpuCuller():
+    cullShader_(cullShaderSource, "sh::GpuCuller cull"),
+    resetShader_(resetShaderSource, "sh::GpuCuller reset")
+{}
+
+void GpuCuller::cull(const float (&planes)[6][4], GLuint instanceBuffer,
+                     GLuint instanceCount, GLuint commandBuffer, GLuint commandCount,
+                     GLuint visibleIdBuffer)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleIdBuffer);
+
+    resetShader_.bind();
+    glUniform1ui(resetShader_.getUniformLocation("commandCount"), commandCount);
+    resetShader_.dispatch(commandCount);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    cullShader_.bind();
+    glUniform4fv(cullShader_.getUniformLocation("planes[0]"), 6, &planes[0][0]);
+    glUniform1ui(cullShader_.getUniformLocation("instanceCount"), instanceCount);
+    glUniform1ui(cullShader_.getUniformLocation("commandCount"), commandCount);
+    cullShader_.dispatch(instanceCount);
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                    GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void cullInstances(const float (&planes)[6][4], const GpuCuller::Instance* instances,
+                   GLuint instanceCount, DrawElementsIndirectCommand* commands,
+                   GLuint commandCount, GLuint* visibleIds, GLuint visibleIdCount)
+{
+    for(GLuint i = 0; i < commandCount; ++i)
+        commands[i].instanceCount = 0;
+
+    for(GLuint id = 0; id < instanceCount; ++id)
+    {
+        auto& instance = instances[id];
+
+        if(instance.drawId >= commandCount)
+            continue;
+
+        auto visible = true;
+
+        for(auto& plane: planes)
+        {
+            if(plane[0] * instance.center[0] + plane[1] * instance.center[1] +
+               plane[2] * instance.center[2] + plane[3] < -instance.radius)
+            {
+                visible = false;
+                break;
+            }
+        }
+
+        if(!visible)
+            continue;
+
+        auto& command = commands[instance.drawId];
+
+        if(command.baseInstance < visibleIdCount &&
+           command.instanceCount < visibleIdCount - command.baseInstance)
+        {
+            visibleIds[command.baseInstance + command.instanceCount++] = id;
+        }
+    }
+}
+
+} // namespace sh
+
+#endif // SHADER_IMPLEMENTATION
@@ -0,0 +1,274 @@
+// MeshBuffer and RangeAllocator, part of Shader.hpp (included by it)
+// in the implementation file:
+
+// #define SHADER_IMPLEMENTATION
+// #include "glad.h" or "glew.h" or ...
+// #include "MeshBuffer.hpp"
+
+#pragma once
+
+#include "Shader.hpp"
+
+namespace sh
+{
+
+// offset allocator over a fixed-size range, free ranges are coalesced on free()
+class RangeAllocator
+{
+public:
+    static constexpr std::size_t invalid = static_cast<std::size_t>(-1);
+
+    RangeAllocator(std::size_t size = 0);
+
+    // returns invalid if there is no free range big enough, alignment 0 is treated as 1
+    std::size_t allocate(std::size_t size, std::size_t alignment = 1);
+
+    // offset must be a value returned by allocate()
+    void free(std::size_t offset);
+
+    std::size_t getSize() const {return size_;}
+    std::size_t getFreeSize() const {return freeSize_;}
+
+private:
+    std::size_t size_;
+    std::size_t freeSize_;
+    std::map<std::size_t, std::size_t> freeRanges_; // offset -> size
+    std::map<std::size_t, std::size_t> allocations_;
+};
+
+// layout of glMultiDrawElementsIndirect() commands
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// many meshes sharing one vertex buffer and one index buffer (GLuint indices)
+// draws use base vertex offsets so one vao can serve all of them
+// vertex attribute layout is up to the user:
+//
+// glBindVertexArray(vao);
+// meshBuffer.bind();
+// glVertexAttribPointer(...);
+//
+class MeshBuffer
+{
+public:
+    struct Mesh
+    {
+        GLuint indexCount = 0;
+        GLuint firstIndex = 0;
+        GLint baseVertex = 0;
+
+        bool isValid() const {return indexCount;}
+    };
+
+    MeshBuffer(std::size_t vertexSize, std::size_t maxVertices, std::size_t maxIndices);
+    ~MeshBuffer();
+    MeshBuffer(const MeshBuffer&) = delete;
+    MeshBuffer& operator=(const MeshBuffer&) = delete;
+
+    // returns invalid mesh if buffers are full
+    Mesh add(const void* vertices, std::size_t vertexCount, const GLuint* indices,
+             std::size_t indexCount);
+
+    void remove(const Mesh& mesh);
+
+    // binds vertex buffer to GL_ARRAY_BUFFER and index buffer to GL_ELEMENT_ARRAY_BUFFER
+    void bind() const;
+
+    // GL_TRIANGLES, vao must be bound
+    void draw(const Mesh& mesh, GLsizei instanceCount = 1) const;
+
+    GLuint getVertexBuffer() const {return vertexBuffer_;}
+    GLuint getIndexBuffer() const {return indexBuffer_;}
+
+    static DrawElementsIndirectCommand getIndirectCommand(const Mesh& mesh,
+                                                          GLuint instanceCount = 1,
+                                                          GLuint baseInstance = 0)
+    {
+        return {mesh.indexCount, instanceCount, mesh.firstIndex, mesh.baseVertex,
+                baseInstance};
+    }
+
+private:
+    std::size_t vertexSize_;
+    GLuint vertexBuffer_;
+    GLuint indexBuffer_;
+    RangeAllocator vertexAllocator_;
+    RangeAllocator indexAllocator_;
+};
+
+} // namespace sh
+
+#ifdef SHADER_IMPLEMENTATION
+
+namespace sh
+{
+
+RangeAllocator::RangeAllocator(std::size_t size):
+    size_(size),
+    freeSize_(size)
+{
+    if(size)
+        freeRanges_[0] = size;
+}
+
+std::size_t RangeAllocator::allocate(std::size_t size, std::size_t alignment)
+{
+    if(!size)
+        return invalid;
+
+    if(!alignment)
+        alignment = 1;
+
+    for(auto it = freeRanges_.begin(); it != freeRanges_.end(); ++it)
+    {
+        auto rangeStart = it->first;
+        auto rangeEnd = it->first + it->second;
+        auto start = (rangeStart + alignment - 1) / alignment * alignment;
+
+        if(start + size > rangeEnd)
+            continue;
+
+        freeRanges_.erase(it);
+
+        if(start > rangeStart)
+            freeRanges_[rangeStart] = start - rangeStart;
+
+        if(start + size < rangeEnd)
+            freeRanges_[start + size] = rangeEnd - start - size;
+
+        allocations_[start] = size;
+        freeSize_ -= size;
+        return start;
+    }
+
+    return invalid;
+}
+
+void RangeAllocator::free(std::size_t offset)
+{
+    auto allocation = allocations_.find(offset);
+
+    if(allocation == allocations_.end())
+    {
+        std::cout << "sh::RangeAllocator: invalid free(), offset = " << offset
+                  << std::endl;
+        return;
+    }
+
+    auto size = allocation->second;
+    allocations_.erase(allocation);
+    freeSize_ += size;
+
+    auto next = freeRanges_.lower_bound(offset);
+
+    if(next != freeRanges_.begin())
+    {
+        auto prev = std::prev(next);
+
+        if(prev->first + prev->second == offset)
+        {
+            offset = prev->first;
+            size += prev->second;
+            freeRanges_.erase(prev);
+        }
+    }
+
+    if(next != freeRanges_.end() && offset + size == next->first)
+    {
+        size += next->second;
+        freeRanges_.erase(next);
+    }
+
+    freeRanges_[offset] = size;
+}
+
+MeshBuffer::MeshBuffer(std::size_t vertexSize, std::size_t maxVertices,
+                       std::size_t maxIndices):
+    vertexSize_(vertexSize),
+    vertexAllocator_(maxVertices),
+    indexAllocator_(maxIndices)
+{
+    // GL_COPY_WRITE_BUFFER leaves the GL_ARRAY_BUFFER binding of the caller alone
+    glGenBuffers(1, &vertexBuffer_);
+    trackObject(GL_BUFFER, vertexBuffer_, vertexSize * maxVertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer_);
+    glBufferData(GL_COPY_WRITE_BUFFER, vertexSize * maxVertices, nullptr,
+                 GL_STATIC_DRAW);
+
+    glGenBuffers(1, &indexBuffer_);
+    trackObject(GL_BUFFER, indexBuffer_, sizeof(GLuint) * maxIndices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer_);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * maxIndices, nullptr,
+                 GL_STATIC_DRAW);
+}
+
+MeshBuffer::~MeshBuffer()
+{
+    deferDeletion(GL_BUFFER, vertexBuffer_);
+    deferDeletion(GL_BUFFER, indexBuffer_);
+}
+
+MeshBuffer::Mesh MeshBuffer::add(const void* vertices, std::size_t vertexCount,
+                                 const GLuint* indices, std::size_t indexCount)
+{
+    auto baseVertex = vertexAllocator_.allocate(vertexCount);
+
+    if(baseVertex == RangeAllocator::invalid)
+        return {};
+
+    auto firstIndex = indexAllocator_.allocate(indexCount);
+
+    if(firstIndex == RangeAllocator::invalid)
+    {
+        vertexAllocator_.free(baseVertex);
+        return {};
+    }
+
+    // GL_COPY_WRITE_BUFFER does not disturb the element buffer of the bound vao
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer_);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * vertexSize_,
+                    vertexCount * vertexSize_, vertices);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer_);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(GLuint),
+                    indexCount * sizeof(GLuint), indices);
+
+    Mesh mesh;
+    mesh.indexCount = indexCount;
+    mesh.firstIndex = firstIndex;
+    mesh.baseVertex = baseVertex;
+    return mesh;
+}
+
+void MeshBuffer::remove(const Mesh& mesh)
+{
+    if(!mesh.isValid())
+        return;
+
+    vertexAllocator_.free(mesh.baseVertex);
+    indexAllocator_.free(mesh.firstIndex);
+}
+
+void MeshBuffer::bind() const
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
+}
+
+void MeshBuffer::draw(const Mesh& mesh, GLsizei instanceCount) const
+{
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+                                      reinterpret_cast<const void*>(mesh.firstIndex *
+                                                                    sizeof(GLuint)),
+                                      instanceCount, mesh.baseVertex);
+}
+
+} // namespace sh
+
+#endif // SHADER_IMPLEMENTATION
@@ -1,11 +1,32 @@
 // made by   m a t i T e c h n o
-// compiles with gcc 7.2.0
+// C++17 with <experimental/filesystem>, tested with gcc 12.2
 // in the implementation file:
 
 // #define SHADER_IMPLEMENTATION
 // #include "glad.h" or "glew.h" or ...
 // #include "Shader.h"
 
+// optional, in the implementation file:
+
+// #define SHADER_GLSLANG
+// hot reloads are validated with glslang on a worker thread before they reach the
+// driver, link with glslang and glslang-default-resource-limits
+
+// #define SHADER_IO_URING
+// Preload reads files through io_uring, link with liburing
+
+// #define SHADER_TRACE
+// startTrace() records a Chrome trace of loading and reloading, also define it in the
+// files using SH_TRACE_SCOPE()
+
+// headers built on it, they include Shader.hpp and are implemented under the same
+// SHADER_IMPLEMENTATION:
+
+// MeshBuffer.hpp - meshes sharing one vertex and one index buffer
+// FramePacer.hpp - caps the frames queued on the gpu
+// GpuCuller.hpp - frustum culling of instances with a compute shader
+// CommandList.hpp - frame commands recorded on any thread, replayed on the GL thread
+
 // shader source format (order does not matter):
 
 // VERTEX
@@ -22,378 +43,5742 @@
 // FRAGMENT
 // ...
 
-// code is exception free
+// shader files and INCLUDE paths are resolved through a virtual filesystem, see
+// mountDirectory()
+
+// precompiled SPIR-V stages (GL 4.6 or GL_ARB_gl_spirv) can be loaded instead, see
+// SpirvStage and shader2spirv.cpp
+
+// defines passed to the constructor are inserted after the #version line of each stage
+// (followed by #line, so driver errors keep the line numbers of the source)
+// optionally, #if / #ifdef / #ifndef branches that can be decided from #defines in the
+// source are removed before glShaderSource(), see setConditionalPruning()
+
+// the library reports errors without exceptions, but std::thread, std::async() (worker
+// threads, SHADER_GLSLANG validation) and allocations can still throw
 // warning: preprocessor parsing is naive
 
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <set>
 #include <map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <optional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <array>
+#include <type_traits>
 #include <experimental/filesystem>
 
+typedef struct __GLsync* GLsync;
+
 namespace sh
 {
 
 namespace fs = std::experimental::filesystem;
 
-class Shader
+using GLint = int;
+using GLuint = unsigned int;
+using GLsizei = int;
+using GLenum = unsigned int;
+using GLfloat = float;
+
+using Defines = std::vector<std::pair<std::string, std::string>>; // name, value
+
+// active uniform of a linked program
+struct UniformInfo
 {
-public:
-    using GLint = int;
-    using GLuint = unsigned int;
+    GLint location;
+    GLenum type; // GL_FLOAT_VEC3, GL_SAMPLER_2D, ...
+};
 
-    Shader(const std::string& filename, bool hotReload = false);
-    Shader(const std::string& source, const char* id);
+using UniformTable = std::map<std::string, UniformInfo>; // key: name
 
-    bool isValid() const {return program_.getId();}
+// 64-bit FNV-1a, chain calls by passing the previous hash
+std::uint64_t hashFnv1a(std::string_view data,
+                        std::uint64_t hash = 14695981039346656037ull);
 
-    GLint getUniformLocation(const std::string& uniformName) const;
+// Chrome trace_event JSON (chrome://tracing, ui.perfetto.dev) of file reads, include
+// expansion, hashing, compilation per stage, linking, reflection and cache accesses,
+// with one track per thread
+// returns false if SHADER_TRACE is not defined or a trace is already running
+bool startTrace(const std::string& filename);
 
-    // after successful reload:
-    //                         * shader must be rebound
-    //                         * all uniform locations are invalidated
-    // on failure:
-    //                         * previous state remains
-    //
-    void reload(); // does not check if file was modified
+// writes the file, returns false on error
+bool stopTrace();
 
-    void bind(); // if hotReload is on and file was modified does reload
+#ifdef SHADER_TRACE
+
+// records [construction, destruction) when a trace is running, detail is copied
+class TraceScope
+{
+public:
+    TraceScope(const char* name, std::string_view detail = {});
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
 
 private:
-    class Program
-    {
-    public:
-        Program(): id_(0) {}
-        Program(GLuint id): id_(id) {}
-        ~Program();
-        Program(const Program&) = delete;
-        Program& operator=(const Program&) = delete;
-        Program(Program&& rhs): id_(rhs.id_) {rhs.id_ = 0;}
+    const char* name_;
+    std::string detail_;
+    std::chrono::steady_clock::time_point start_;
+    bool active_;
+};
 
-        Program& operator=(Program&& rhs)
-        {
-            if(this == &rhs)
-                return *this;
-            this->~Program();
-            id_ = rhs.id_;
-            rhs.id_ = 0;
-            return *this;
-        }
+#define SH_TRACE_CONCAT_(lhs, rhs) lhs##rhs
+#define SH_TRACE_CONCAT(lhs, rhs) SH_TRACE_CONCAT_(lhs, rhs)
+#define SH_TRACE_SCOPE(name, detail) \
+    sh::TraceScope SH_TRACE_CONCAT(shTraceScope, __LINE__)(name, detail)
 
-        GLuint getId() const {return id_;}
+#else
 
-    private:
-        GLuint id_;
-    };
+// arguments are not evaluated
+#define SH_TRACE_SCOPE(name, detail) ((void)0)
 
-    std::string id_;
-    bool hotReload_;
-    Program program_;
-    fs::file_time_type fileLastWriteTime_;
-    std::map<std::string, GLint> uniformLocations_;
-    mutable std::set<std::string> inactiveUniforms_;
+#endif
 
-    // returns true on success
-    bool swapProgram(const std::string& source);
-};
+// deferred deletion of GL objects (type: GL_PROGRAM, GL_SHADER or GL_BUFFER)
+// when enabled, programs replaced on reload or destroyed with their Shader, shader
+// objects and buffers released by the library are deleted only after the fence of the
+// frame that released them has signalled, processDeferredDeletions() must then be
+// called once per frame after the last draw
+// disabling waits for the fences of the queued objects (blocks) and deletes them
+//
+// disabled by default
+void setDeferredDeletion(bool enabled);
 
-} // namespace sh
+// deletes immediately when deferred deletion is disabled
+void deferDeletion(GLenum type, GLuint id);
 
-#ifdef SHADER_IMPLEMENTATION
+void processDeferredDeletions();
 
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <algorithm>
+// deletes all queued objects without waiting for fences
+void flushDeferredDeletions();
 
-namespace sh
-{
-    
-Shader::Program::~Program() {if(id_) glDeleteProgram(id_);}
+// recycling of program and shader objects for reload-heavy workflows
+// released objects (after deferred deletion, if enabled) are kept in a pool of up to
+// maxPooled objects per type and reused by the next build instead of recreated
+// objects of SPIR-V builds are not recycled
+//
+// 0 disables recycling and deletes the pooled objects (default)
+void setObjectRecycling(std::size_t maxPooled);
 
-std::string loadSourceFromFile(const std::string& filename)
+struct RecyclingStats
 {
-    std::ifstream file(filename);
+    std::size_t programsCreated = 0;
+    std::size_t programsReused = 0;
+    std::size_t shadersCreated = 0;
+    std::size_t shadersReused = 0;
+    std::size_t deleted = 0; // pool full or recycling disabled
+    std::size_t pooled = 0;  // currently in the pool
 
-    if(!file.is_open())
+    // fraction of objects not created thanks to recycling
+    float getReuseRate() const
     {
-        std::cout << "sh::Shader: could not open file = " << filename << std::endl;
-        return {};
+        auto reused = programsReused + shadersReused;
+        auto total = reused + programsCreated + shadersCreated;
+        return total ? float(reused) / total : 0.f;
     }
+};
 
-    std::stringstream stringstream;
-    stringstream << file.rdbuf();
-    auto source = stringstream.str();
-    
-    static const std::string includeDirective = "INCLUDE";
-
-    auto lineFirst = source.find(includeDirective);
-
-    if(lineFirst != std::string::npos)
-    {
-        auto lineLast = source.find('\n', lineFirst) + 1;
-
-        auto filenameFirst = source.find('"', lineFirst + includeDirective.size()) + 1;
-
-        auto filenameCount = source.find('"', filenameFirst) - filenameFirst;
-        
-        source.insert(lineLast,
-                      loadSourceFromFile(source.substr(filenameFirst, filenameCount)));
+RecyclingStats getRecyclingStats();
 
-        source.erase(lineFirst, lineLast - lineFirst);
-    }
+// after warm-up: calls glReleaseShaderCompiler() and blocks GLSL compilation, programs
+// still come from the binary cache (see setCacheDirectory()) and from SPIR-V
+// Refuse: builds fail, shaders keep their current program
+// Defer:  a shader retries its build on bind() once resumeCompilation() is called
+enum class CompilerRelease {Refuse, Defer};
 
-    return source;
-}
+void releaseShaderCompiler(CompilerRelease mode = CompilerRelease::Refuse);
+void resumeCompilation();
+bool isCompilationAllowed();
 
-fs::file_time_type getFileLastWriteTime(const std::string& filename)
+// GL objects owned by the library (programs, shader objects, MeshBuffer buffers)
+// bytes are driver-side estimates: program binary length, shader source or SPIR-V
+// length, buffer storage size
+struct MemoryStats
 {
-    std::error_code ec;
-    auto time = fs::last_write_time(filename, ec);
-
-    if(ec)
+    struct Objects
     {
-        std::cout << "sh::Shader: last_write_time() failed, file = "
-                  << filename << std::endl;
-    }
+        std::size_t count = 0;
+        std::size_t bytes = 0;
+    };
 
-    return time;
-}
+    Objects programs;
+    Objects shaders;
+    Objects buffers;
+};
 
-Shader::Shader(const std::string& filename, bool hotReload):
-    id_(filename),
-    hotReload_(hotReload)
+MemoryStats getMemoryStats();
+
+// always-on counters of the library (relaxed atomics, cheap on the hot paths)
+// uniformSets, uniformSetsSkipped: uniform commands replayed by CommandList, skipped if
+// the uniform failed validation or is inactive (location -1), TypedShader::set() and
+// setUniform() are not counted to keep them one GL call, redundant sets are not detected
+// compileTime: ms the calling thread spent in programBuilds (a build overlapped by
+// ShaderLibrary::loadDirectory() counts its wait only)
+struct Metrics
 {
-    fileLastWriteTime_ = getFileLastWriteTime(filename);
+    std::uint64_t binds = 0;
+    std::uint64_t bindsElided = 0;            // see setBindElision()
+    std::uint64_t uniformLookups = 0;         // getUniformLocation()
+    std::uint64_t inactiveUniformLookups = 0;
+    std::uint64_t uniformSets = 0;
+    std::uint64_t uniformSetsSkipped = 0;
+    std::uint64_t reloads = 0;                // reload() and hot reloads
+    std::uint64_t reloadFailures = 0;
+    std::uint64_t cacheHits = 0;              // source and binary cache
+    std::uint64_t cacheMisses = 0;
+    std::uint64_t programBuilds = 0;          // successful GLSL program builds
+    double compileTime = 0.0;
+    std::uint64_t dispatchesRejected = 0;     // Shader::dispatch() over the group limit
+};
 
-    if(auto source = loadSourceFromFile(filename); source.size())
-        swapProgram(source);
-}
+// snapshot, with reset == true the counters restart from 0 (each count is reported in
+// exactly one snapshot)
+Metrics getMetrics(bool reset = false);
 
-Shader::Shader(const std::string& source, const char* id):
-    id_(id),
-    hotReload_(false)
-{
-    swapProgram(source);
-}
+// Shader::bind() skips glUseProgram() when the program is already bound
+// call invalidateBoundProgram() after binding programs without Shader::bind()
+// (glUseProgram() outside of the library, other contexts, ...)
+//
+// disabled by default
+void setBindElision(bool enabled);
+void invalidateBoundProgram();
 
-void Shader::bind()
+// program with compilation and linking in progress (see beginProgram())
+struct ProgramBuild
 {
-    if(hotReload_)
+    struct Stage
     {
-        if(auto time = getFileLastWriteTime(id_); time > fileLastWriteTime_)
-        {
-            fileLastWriteTime_ = time;
-            
-            if(auto source = loadSourceFromFile(id_); source.size())
-                if(swapProgram(source))
-                    std::cout << "sh::Shader, " << id_
-                              << ": hot reload succeeded" << std::endl;
-        }
-    }
+        GLuint shader;
+        const char* name;
+    };
 
-    glUseProgram(program_.getId());
-}
+    GLuint program = 0;
+    std::vector<Stage> stages;
+    std::size_t spirvSize = 0; // memory estimate, SPIR-V programs can't be queried
+};
 
-GLint Shader::getUniformLocation(const std::string& uniformName) const
+// source of one stage after INCLUDE expansion, define injection and conditional pruning
+struct StageSource
 {
-    auto it = uniformLocations_.find(uniformName);
+    GLenum type;
+    const char* name;
+    std::string source;
+};
 
-    if(it == uniformLocations_.end() &&
-        inactiveUniforms_.find(uniformName) == inactiveUniforms_.end())
-    {
-        std::cout << "sh::Shader, " << id_ << ": inactive uniform = "
-                  << uniformName << std::endl;
+// evaluate preprocessor conditionals on the cpu
+// conditionals depending on macros predefined by the driver (GL_*, __*) or on macros
+// of undecidable branches are left for the driver, so are expressions that overflow
+// and sources with a directive right after a multi-line comment
+//
+// disabled by default
+void setConditionalPruning(bool enabled);
 
-        inactiveUniforms_.insert(uniformName);
+// virtual filesystem
+// path = mount point + path inside the mount, mounts are searched from the most recent
+// to the oldest so later mounts overlay earlier ones, lookups are cached
+// by default the working directory is mounted at ""
+void mountDirectory(const std::string& mountPoint, const std::string& directory);
 
-        return 666;
-    }
+// served from memory without syscalls (generated snippets), mounting the same path again
+// replaces the contents and counts as a modification for hot reload
+void mountMemory(const std::string& path, std::string contents);
 
-    return it->second;
-}
+// pack archive written by writePack(), loaded in memory, returns false on error
+bool mountPack(const std::string& mountPoint, const std::string& filename);
 
-void Shader::reload()
-{
-    if(auto time = getFileLastWriteTime(id_); time > fileLastWriteTime_)
-        fileLastWriteTime_ = time;
+// removes all mounts but the default one
+void clearMounts();
 
-    if(auto source = loadSourceFromFile(id_); source.size())
-        if(swapProgram(source))
-            std::cout << "sh::Shader, " << id_ << ": reload succeeded" << std::endl;
-}
+std::optional<std::string> readFile(const std::string& path);
 
-template<bool isProgram>
-std::optional<std::string> getError(GLuint id, GLenum flag)
-{
-    GLint success;
+// format: "SHPACK1\n" then for each file "path\nsize\n" followed by size bytes
+// files are read through the virtual filesystem, returns false on error
+bool writePack(const std::string& filename, const std::vector<std::string>& paths);
 
-    if constexpr (isProgram)
-        glGetProgramiv(id, flag, &success);
-    else
-        glGetShaderiv(id, flag, &success);
+// files in directory and its subdirectories (disk only) whose names match pattern
+// ('*' and '?' wildcards), sorted
+std::vector<std::string> listDirectory(const std::string& directory,
+                                       const std::string& pattern = "*.sh");
 
-    if(success == GL_TRUE)
-        return {};
+// on-disk cache of preprocessed sources (INCLUDE expansion, define injection and
+// conditional pruning), an entry is used only if the last write times (contents for
+// memory mounts, the pack's time for pack mounts) and sizes of all the files it was
+// expanded from are unchanged, "" disables the cache (default)
+// program binaries are cached there too (with their uniform locations), if the driver
+// supports GL_PROGRAM_BINARY formats
+// the directory can be shared by processes, see setCacheSizeLimit()
+void setCacheDirectory(const std::string& directory);
 
-    GLint length;
-    if constexpr (isProgram)
-        glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
-    else
-        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+// least recently used entries are evicted after a write makes the directory exceed the
+// limit (the compile times of saveCompileCosts() are kept and not counted),
+// 0: unlimited (default)
+void setCacheSizeLimit(std::uintmax_t bytes);
 
-    if(!length)
-        return "";
+// merges the program build times measured by this process into the cache directory,
+// called by ShaderLibrary::loadDirectory() and at exit
+void saveCompileCosts();
 
-    --length;
-    std::string log(length, '\0');
+// counters of this process
+struct CacheStats
+{
+    std::size_t hits = 0;
+    std::size_t misses = 0; // includes stale entries
+    std::size_t writes = 0;
+    std::size_t evictions = 0;
 
-    if constexpr (isProgram)
-        glGetProgramInfoLog(id, length, nullptr, log.data());
-    else
-        glGetShaderInfoLog(id, length, nullptr, log.data());
+    double getHitRate() const {return hits + misses ? double(hits) / (hits + misses) : 0.0;}
+};
 
-    return log;
-}
+CacheStats getCacheStats();
 
-// shader must be cleaned by caller with glDeleteShader()
-GLuint createAndCompileShader(GLenum type, const std::string& source)
+// bulk loading, reads the files and the files they INCLUDE in batches (contents and
+// last write times), with io_uring if SHADER_IO_URING is defined and worker threads
+// otherwise, files of memory and pack mounts are not read again
+// while the object exists readFile() and hot reload timestamps of the preloaded paths
+// are served from memory, construct the shaders in its scope:
+//
+// {
+//     auto filenames = sh::listDirectory("shaders");
+//     sh::Preload preload(filenames);
+//
+//     for(auto& filename: filenames)
+//         shaders.emplace_back(filename, true);
+// }
+//
+// only one Preload object may exist at a time
+class Preload
 {
-    auto id = glCreateShader(type);
-    auto* str = source.c_str();
-    glShaderSource(id, 1, &str, nullptr);
-    glCompileShader(id);
-    return id;
-}
+public:
+    Preload(const std::vector<std::string>& paths);
+    ~Preload();
+    Preload(const Preload&) = delete;
+    Preload& operator=(const Preload&) = delete;
 
-// returns 0 on error
-// when return value != 0 program must be cleaned by caller with glDeleteProgram()
-GLuint createProgram(const std::string& source, const std::string& id)
+    // files read from disk, includes count
+    std::size_t getFileCount() const {return fileCount_;}
+    std::size_t getByteCount() const {return byteCount_;}
+
+private:
+    std::size_t fileCount_ = 0;
+    std::size_t byteCount_ = 0;
+};
+
+// work-stealing thread pool, tasks are distributed round-robin over per-worker queues,
+// workers run their own queue from the front and steal from the back of the others
+class ThreadPool
 {
-    struct ShaderType
-    {
-        GLenum value;
-        std::string name;
-    };
+public:
+    // threadCount == 0: hardware_concurrency()
+    ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
-    static const ShaderType shaderTypes[] = {{GL_VERTEX_SHADER,   "VERTEX"},
-                                             {GL_GEOMETRY_SHADER, "GEOMETRY"},
-                                             {GL_FRAGMENT_SHADER, "FRAGMENT"},
-                                             {GL_COMPUTE_SHADER,  "COMPUTE"}};
-    
-    struct ShaderData
-    {
-        std::size_t sourceStart;
-        const ShaderType* type;
-    };
+    void submit(std::function<void()> task);
 
-    std::vector<ShaderData> shaderData;
+    // returns when all submitted tasks are done
+    void wait();
 
-    for(auto& shaderType: shaderTypes)
-    {
-        if(auto pos = source.find(shaderType.name); pos != std::string::npos)
-            shaderData.push_back({pos + shaderType.name.size(), &shaderType});
-    }
+    int getThreadCount() const {return threads_.size();}
 
-    std::sort(shaderData.begin(), shaderData.end(),
-              [](ShaderData& l, ShaderData& r)
-              {return l.sourceStart < r.sourceStart;});
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
 
-    std::vector<GLuint> shaders;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> pending_{0}; // queued or running
+    std::atomic<std::size_t> nextQueue_{0};
+    std::mutex mutex_;
+    std::condition_variable taskAvailable_;
+    std::condition_variable tasksDone_;
+    bool stop_ = false;
 
-    auto compilationError = false;
+    // returns an empty function if all queues are empty
+    std::function<void()> pop(std::size_t queueIndex);
 
-    for(auto it = shaderData.begin(); it != shaderData.end(); ++it)
-    {
-        std::size_t count;
-        if(it == shaderData.end() - 1)
-            count = std::string::npos;
-        else
-        {
-            auto nextIt = it + 1;
-            count = nextIt->sourceStart - nextIt->type->name.size()
-                    - it->sourceStart;
-        }
+    void run(std::size_t queueIndex);
+};
 
-        shaders.push_back(createAndCompileShader(it->type->value,
-                                                 source.substr(it->sourceStart,
-                                                               count)));
+// SPIR-V module of one stage, requires GL 4.6 or GL_ARB_gl_spirv
+// produced offline from .sh sources by shader2spirv
+struct SpirvStage
+{
+    GLenum type; // GL_VERTEX_SHADER, ...
+    std::string filename;
+    std::string entryPoint = "main";
+    // specialization constant id (constant_id), value as 32 bits
+    // (use std::memcpy for floats)
+    std::vector<std::pair<GLuint, GLuint>> constants;
+};
 
-        if(auto error = getError<false>(shaders.back(), GL_COMPILE_STATUS))
-        {
-            std::cout << "sh::Shader, " << id << ": " << it->type->name.c_str()
-                      << " shader compilation failed\n"
-                      << *error << std::endl;
+// string joined at compile time, for shader sources assembled from snippets:
+//
+// constexpr sh::FixedString version("#version 330\n");
+// constexpr sh::FixedString lighting("vec3 light(vec3 n) {...}\n");
+// static constexpr auto source = "VERTEX\n" + version + vertexBody +
+//                                "FRAGMENT\n" + version + "#define LIGHTS 4\n" +
+//                                lighting + fragmentBody;
+// sh::Shader shader(source, "lit");
+//
+// only the concatenation happens at compile time: the Shader constructor copies the
+// source once into a std::string, splits the stages and inserts the Defines passed to
+// it at runtime like for any other source, defines written into the snippets just
+// skip that insertion
+template<std::size_t N>
+struct FixedString
+{
+    char data[N + 1] = {};
 
-            compilationError = true;
-        }
-    }
+    constexpr FixedString() = default;
 
-    if(compilationError)
+    constexpr FixedString(const char (&str)[N + 1])
     {
-        for(auto shader: shaders)
-            glDeleteShader(shader);
-
-        return 0;
+        for(std::size_t i = 0; i < N; ++i)
+            data[i] = str[i];
     }
 
-    auto program = glCreateProgram();
+    static constexpr std::size_t size() {return N;}
+    constexpr const char* c_str() const {return data;}
+    constexpr operator std::string_view() const {return {data, N};}
+};
 
-    for(auto shader: shaders)
-        glAttachShader(program, shader);
+template<std::size_t N>
+FixedString(const char (&)[N]) -> FixedString<N - 1>;
 
-    glLinkProgram(program);
+template<std::size_t N, std::size_t M>
+constexpr FixedString<N + M> operator+(const FixedString<N>& lhs, const FixedString<M>& rhs)
+{
+    FixedString<N + M> result;
 
-    for(auto shader: shaders)
-    {
-        glDetachShader(program, shader);
-        glDeleteShader(shader);
-    }
+    for(std::size_t i = 0; i < N; ++i)
+        result.data[i] = lhs.data[i];
 
-    if(auto error = getError<true>(program, GL_LINK_STATUS))
-    {
-        std::cout << "sh::Shader, " << id << ": program linking failed\n"
-                  << *error << std::endl;
+    for(std::size_t i = 0; i < M; ++i)
+        result.data[N + i] = rhs.data[i];
 
-        glDeleteProgram(program);
-        return 0;
-    }
+    return result;
+}
 
-    return program;
+template<std::size_t N, std::size_t M>
+constexpr FixedString<N + M - 1> operator+(const FixedString<N>& lhs, const char (&rhs)[M])
+{
+    return lhs + FixedString<M - 1>(rhs);
 }
 
-bool Shader::swapProgram(const std::string& source)
+template<std::size_t N, std::size_t M>
+constexpr FixedString<N + M - 1> operator+(const char (&lhs)[N], const FixedString<M>& rhs)
 {
-    auto newProgram = createProgram(source, id_);
-    if(!newProgram)
-        return false;
-    
-    program_ = Program(newProgram);
-    
-    uniformLocations_.clear();
-    inactiveUniforms_.clear();
+    return FixedString<N - 1>(lhs) + rhs;
+}
 
-    GLint numUniforms;
-    glGetProgramiv(program_.getId(), GL_ACTIVE_UNIFORMS, &numUniforms);
+class Shader
+{
+public:
+    using GLint = sh::GLint;
+    using GLuint = sh::GLuint;
 
-    std::vector<char> uniformName(256);
+    Shader(const std::string& filename, bool hotReload = false,
+           const Defines& defines = {});
 
-    for(int i = 0; i < numUniforms; ++i)
-    {
-        GLint dum1;
-        GLenum dum2;
+    Shader(const std::string& source, const char* id, const Defines& defines = {});
 
-        glGetActiveUniform(program_.getId(), i, uniformName.size(), nullptr,
-                           &dum1, &dum2, uniformName.data());
+    // source composed at compile time, copied once, then built like any other source
+    template<std::size_t N>
+    Shader(const FixedString<N>& source, const char* id, const Defines& defines = {}):
+        Shader(std::string(source.data, N), id, defines) {}
 
-        auto uniformLocation = glGetUniformLocation(program_.getId(),
-                                                    uniformName.data());
+    // reload() reloads the binaries, specialize() and setFeedbackVaryings() are not
+    // supported (use SpirvStage::constants and xfb_* layout qualifiers)
+    Shader(const std::vector<SpirvStage>& stages, const char* id);
 
-        uniformLocations_[uniformName.data()] = uniformLocation;
-    }
+    bool isValid() const {return program_.getId();}
 
-    return true;
+    // -1 if the uniform is inactive (printed once per name), glUniform*() ignores -1
+    GLint getUniformLocation(const std::string& uniformName) const;
+
+    // after successful reload:
+    //                         * shader must be rebound
+    //                         * all uniform locations are invalidated
+    // on failure:
+    //                         * previous state remains
+    //
+    void reload(); // does not check if file was modified
+
+    void bind(); // if hotReload is on and file was modified does reload
+
+    // varyings captured with transform feedback (interleaved), declared before linking
+    // program is relinked, returns true on success (same rules as reload())
+    bool setFeedbackVaryings(const std::vector<std::string>& varyings);
+
+    // uniform declaration 'uniform type name;' is replaced with a constant in a
+    // program variant, value is a GLSL expression, e.g. "4", "true", "vec2(1.0, 0.5)"
+    // variants are cached, compilation starts on the next bind() and bind() switches to
+    // the variant once it is built, the generic program is used meanwhile
+    // the build is polled with GL_KHR_parallel_shader_compile, without it bind() waits
+    // for a fence issued after the build (drivers compiling lazily can still block the
+    // switch)
+    // keep setting specialized uniforms, getUniformLocation() returns -1 for them
+    // while the variant is active
+    void specialize(const std::string& uniformName, const std::string& value);
+    void clearSpecializations();
+
+    bool isVariantActive() const {return variant_ && variant_->program.getId();}
+
+    // compute shaders, shader must be bound
+    // dispatches enough work groups to cover sizeX * sizeY * sizeZ invocations,
+    // whatever the local size of the program is
+    // a group count over GL_MAX_COMPUTE_WORK_GROUP_COUNT is printed and not dispatched
+    void dispatch(GLuint sizeX, GLuint sizeY = 1, GLuint sizeZ = 1);
+
+private:
+    friend class ShaderLibrary;
+    friend class CommandList;
+    template<typename... Uniforms> friend class TypedShader;
+
+    // takes ownership of program (0 if the build failed)
+    Shader(const std::string& filename, bool hotReload, const Defines& defines,
+           fs::file_time_type fileLastWriteTime, const std::string& source,
+           GLuint program, const UniformTable* uniforms);
+
+    class Program
+    {
+    public:
+        Program(): id_(0) {}
+        Program(GLuint id): id_(id) {}
+        ~Program();
+        Program(const Program&) = delete;
+        Program& operator=(const Program&) = delete;
+        Program(Program&& rhs): id_(rhs.id_) {rhs.id_ = 0;}
+
+        // previous program goes through deferDeletion()
+        // released programs return to the pool when setObjectRecycling() is enabled
+        Program& operator=(Program&& rhs);
+
+        GLuint getId() const {return id_;}
+
+    private:
+        GLuint id_;
+    };
+
+    std::string id_;
+    bool hotReload_;
+    Program program_;
+    fs::file_time_type fileLastWriteTime_;
+    UniformTable uniforms_;
+    mutable std::set<std::string> inactiveUniforms_;
+    std::string source_; // of the current program
+    Defines defines_;
+    std::vector<std::string> feedbackVaryings_;
+    std::vector<SpirvStage> spirvStages_; // empty for GLSL programs
+
+    struct Variant
+    {
+        Program program;
+        UniformTable uniforms;
+        ProgramBuild build; // in progress if program != 0
+        GLsync fence = nullptr; // issued after the build without parallel shader compile
+    };
+
+    std::map<std::string, std::string> specializations_;
+    std::map<std::string, Variant> variants_; // key: specializations
+    Variant* variant_ = nullptr;
+    bool variantDirty_ = false;
+    GLint localSize_[3] = {}; // queried on first dispatch()
+
+    // called after the active program changed (ids can't tell, programs are recycled),
+    // set by TypedShader
+    void (*programChanged_)(Shader&) = nullptr;
+
+    struct Validation
+    {
+        std::string source;
+        std::vector<StageSource> stages;
+        bool valid;
+    };
+
+    std::future<Validation> validation_; // SHADER_GLSLANG
+
+    bool compileDeferred_ = false; // see CompilerRelease::Defer
+    std::string deferredSource_;
+
+    // prints that the build is refused or deferred
+    void deferCompile(const std::string& source);
+
+    // returns true on success, source is ignored for SPIR-V programs
+    bool swapProgram(const std::string& source);
+
+    // preprocesses file id_ (through the cache, see setCacheDirectory()) and swaps
+    // the program, returns true on success
+    bool swapProgramFromFile();
+
+    bool swapProgram(const std::vector<StageSource>& stages, const std::string& source);
+
+    // takes ownership of program, returns false if program == 0
+    // uniforms: restored reflection, queried if nullptr
+    bool setProgram(GLuint program, const std::string& source,
+                    const UniformTable* uniforms = nullptr);
+
+    void notifyProgramChanged() {if(programChanged_) programChanged_(*this);}
+
+    // returns true if the active program changed
+    bool updateVariant();
+
+    GLuint getActiveProgramId() const
+    {
+        return isVariantActive() ? variant_->program.getId() : program_.getId();
+    }
+
+    // location in the active program, -1 if the uniform is inactive or of another type
+    // (errors are printed), or specialized in the active variant
+    // arrays are found by their name too ("lights" is "lights[0]")
+    GLint validateUniform(const char* uniformName, GLenum type) const;
+};
+
+// declares the uniform descriptor struct descriptorName for TypedShader
+// type: GLfloat, GLint (also samplers and images), GLuint, bool,
+//       vectors GLfloat[N], GLint[N], GLuint[N], matrices GLfloat[N][N] (column-major)
+#define SH_UNIFORM(descriptorName, uniformName, type) \
+    struct descriptorName                             \
+    {                                                 \
+        static constexpr const char* name = uniformName; \
+        using Type = type;                            \
+    }
+
+// GL type of the uniform declaration matching a C++ type
+template<typename T>
+struct UniformType;
+
+template<> struct UniformType<GLfloat>        {static constexpr GLenum value = 0x1406;};
+template<> struct UniformType<GLfloat[2]>     {static constexpr GLenum value = 0x8B50;};
+template<> struct UniformType<GLfloat[3]>     {static constexpr GLenum value = 0x8B51;};
+template<> struct UniformType<GLfloat[4]>     {static constexpr GLenum value = 0x8B52;};
+template<> struct UniformType<GLint>          {static constexpr GLenum value = 0x1404;};
+template<> struct UniformType<GLint[2]>       {static constexpr GLenum value = 0x8B53;};
+template<> struct UniformType<GLint[3]>       {static constexpr GLenum value = 0x8B54;};
+template<> struct UniformType<GLint[4]>       {static constexpr GLenum value = 0x8B55;};
+template<> struct UniformType<GLuint>         {static constexpr GLenum value = 0x1405;};
+template<> struct UniformType<GLuint[2]>      {static constexpr GLenum value = 0x8DC6;};
+template<> struct UniformType<GLuint[3]>      {static constexpr GLenum value = 0x8DC7;};
+template<> struct UniformType<GLuint[4]>      {static constexpr GLenum value = 0x8DC8;};
+template<> struct UniformType<bool>           {static constexpr GLenum value = 0x8B56;};
+template<> struct UniformType<GLfloat[2][2]>  {static constexpr GLenum value = 0x8B5A;};
+template<> struct UniformType<GLfloat[3][3]>  {static constexpr GLenum value = 0x8B5B;};
+template<> struct UniformType<GLfloat[4][4]>  {static constexpr GLenum value = 0x8B5C;};
+
+// glProgramUniform*() for each UniformType, location -1 is ignored by GL
+void setUniform(GLuint program, GLint location, GLfloat value);
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[2]);
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[3]);
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[4]);
+void setUniform(GLuint program, GLint location, GLint value);
+void setUniform(GLuint program, GLint location, const GLint (&value)[2]);
+void setUniform(GLuint program, GLint location, const GLint (&value)[3]);
+void setUniform(GLuint program, GLint location, const GLint (&value)[4]);
+void setUniform(GLuint program, GLint location, GLuint value);
+void setUniform(GLuint program, GLint location, const GLuint (&value)[2]);
+void setUniform(GLuint program, GLint location, const GLuint (&value)[3]);
+void setUniform(GLuint program, GLint location, const GLuint (&value)[4]);
+void setUniform(GLuint program, GLint location, bool value);
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[2][2]);
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[3][3]);
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[4][4]);
+
+// compile-time uniform interface, declared with SH_UNIFORM() descriptors:
+//
+// SH_UNIFORM(Mvp, "MVP", GLfloat[4][4]);
+// SH_UNIFORM(Color, "color", GLfloat[4]);
+// SH_UNIFORM(Texture, "tex", GLint);
+//
+// sh::TypedShader<Mvp, Color, Texture> shader("my_shader.sh", true);
+// shader.bind();
+// shader.set<Mvp>(mvp);
+//
+// locations are kept in an array and validated against the reflection of the program
+// on construction and again whenever the program changes (reload, variant switch, also
+// when bound through Shader&), set() is one glProgramUniform*() call, the shader does
+// not need to be bound
+// array uniforms can be named without "[0]", set() writes the first element
+template<typename... Uniforms>
+class TypedShader: public Shader
+{
+public:
+    static_assert(sizeof...(Uniforms) > 0, "TypedShader without uniforms");
+
+    TypedShader(const std::string& filename, bool hotReload = false,
+                const Defines& defines = {}):
+        Shader(filename, hotReload, defines) {initialize();}
+
+    TypedShader(const std::string& source, const char* id, const Defines& defines = {}):
+        Shader(source, id, defines) {initialize();}
+
+    template<std::size_t N>
+    TypedShader(const FixedString<N>& source, const char* id, const Defines& defines = {}):
+        Shader(source, id, defines) {initialize();}
+
+    TypedShader(const std::vector<SpirvStage>& stages, const char* id):
+        Shader(stages, id) {initialize();}
+
+    // ignored for uniforms that failed validation, the shader must be valid
+    template<typename Uniform>
+    void set(const typename Uniform::Type& value)
+    {
+        static constexpr auto index = getIndex<Uniform>();
+        static_assert(index < sizeof...(Uniforms), "uniform not in the TypedShader list");
+        setUniform(programId_, locations_[index], value);
+    }
+
+    template<typename Uniform>
+    GLint getLocation() const
+    {
+        static constexpr auto index = getIndex<Uniform>();
+        static_assert(index < sizeof...(Uniforms), "uniform not in the TypedShader list");
+        return locations_[index];
+    }
+
+private:
+    GLuint programId_ = 0; // active program of the locations
+    std::array<GLint, sizeof...(Uniforms)> locations_ = getInvalidLocations();
+
+    static constexpr std::array<GLint, sizeof...(Uniforms)> getInvalidLocations()
+    {
+        std::array<GLint, sizeof...(Uniforms)> locations = {};
+
+        for(auto& location: locations)
+            location = -1;
+
+        return locations;
+    }
+
+    template<typename Uniform>
+    static constexpr std::size_t getIndex()
+    {
+        constexpr bool matches[] = {std::is_same_v<Uniform, Uniforms>...};
+
+        for(std::size_t i = 0; i < sizeof...(Uniforms); ++i)
+        {
+            if(matches[i])
+                return i;
+        }
+
+        return sizeof...(Uniforms);
+    }
+
+    // the programs of the constructor were set before the hook
+    void initialize()
+    {
+        programChanged_ = &updateLocations;
+        updateLocations(*this);
+    }
+
+    static void updateLocations(Shader& shader)
+    {
+        auto& typedShader = static_cast<TypedShader&>(shader);
+        typedShader.programId_ = typedShader.getActiveProgramId();
+        typedShader.locations_ = {typedShader.validateUniform(
+            Uniforms::name, UniformType<typename Uniforms::Type>::value)...};
+    }
+};
+
+// shaders loaded in bulk
+// INCLUDE expansion, define injection, conditional pruning, stage splitting and hashing
+// run on a thread pool, only GL calls are made on the calling thread; compilation of all
+// programs is issued before the first result is queried, so drivers with
+// GL_KHR_parallel_shader_compile compile them in parallel
+// builds are issued longest first, by their compile times from earlier runs or else by
+// their source size; times are kept in the cache directory (see setCacheDirectory()) and
+// recorded only from builds measured alone, not from the overlapped ones of a parallel
+// compiling driver
+class ShaderLibrary
+{
+public:
+    struct LoadStats
+    {
+        std::size_t fileCount = 0;
+        std::size_t validCount = 0;
+        double preprocessTime = 0.0; // ms, thread pool
+        double compileTime = 0.0;    // ms, calling thread
+        std::size_t knownCostCount = 0; // builds with a compile time from earlier runs
+    };
+
+    // threadCount == 0: hardware_concurrency()
+    ShaderLibrary(int threadCount = 0): pool_(threadCount) {}
+
+    // pattern is matched against file names (see listDirectory()), files already
+    // loaded are skipped, invalid shaders are kept (they can be fixed by hot reload)
+    LoadStats loadDirectory(const std::string& path, const std::string& pattern = "*.sh",
+                            bool hotReload = false, const Defines& defines = {});
+
+    // nullptr if filename was not loaded, filename as returned by listDirectory()
+    Shader* get(const std::string& filename);
+
+    // of the preprocessed stage sources, 0 if filename was not loaded
+    std::uint64_t getHash(const std::string& filename) const;
+
+    std::size_t size() const {return shaders_.size();}
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<Shader> shader;
+        std::uint64_t hash;
+    };
+
+    ThreadPool pool_;
+    std::map<std::string, Entry> shaders_;
+};
+
+struct FeedbackCapture
+{
+    GLuint buffer = 0; // must be cleaned by caller with glDeleteBuffers()
+    GLuint primitiveCount = 0;
+    GLsizei vertexCount = 0; // to redraw the buffer with glDrawArrays()
+};
+
+// runs glDrawArrays(drawMode, 0, vertexCount) with the bound program and vao once,
+// with rasterization disabled, and captures the feedback varyings into a new buffer
+// primitiveMode is the output of the last stage: GL_POINTS, GL_LINES or GL_TRIANGLES
+// returns buffer == 0 on error or if no primitive was captured
+// glGetError() is not called (pending errors of the application stay queued), the
+// GL_TRANSFORM_FEEDBACK_BUFFER bindings and GL_RASTERIZER_DISCARD are restored
+FeedbackCapture captureFeedback(GLenum drawMode, GLsizei vertexCount,
+                                GLenum primitiveMode, std::size_t bufferSize);
+
+// compiles each variant (set of defines) of a shader file and times draw() with
+// GL_TIME_ELAPSED queries (cpu time if the queries are unreliable), the shader is
+// bound before each draw() call
+// variants whose Shader::dispatch() is rejected (group count limit) are skipped, GL
+// errors are not checked (the error queue of the application is left alone)
+// the winner is stored per GL_RENDERER in cacheFilename and later calls return it
+// without timing
+// returns index of the fastest variant, -1 if no variant compiled
+int tuneVariants(const std::string& filename, const std::vector<Defines>& variants,
+                 const std::function<void(Shader&)>& draw,
+                 const std::string& cacheFilename, int iterations = 10);
+
+struct WorkGroupSize
+{
+    GLuint x = 1;
+    GLuint y = 1;
+    GLuint z = 1;
+};
+
+// LOCAL_SIZE_X, LOCAL_SIZE_Y and LOCAL_SIZE_Z
+Defines getWorkGroupDefines(const WorkGroupSize& size);
+
+// compute shader must declare:
+// layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y,
+//        local_size_z = LOCAL_SIZE_Z) in;
+// candidates are benchmarked with tuneVariants(), dispatch() should use
+// Shader::dispatch() so the work stays the same for every candidate
+// shaders of filename created afterwards (Shader, ShaderLibrary) get the defines of the
+// result unless LOCAL_SIZE_X is passed, call it at startup (cached results are
+// returned without timing) so Shader::dispatch() picks the tuned size up
+// returns x = 0 if no candidate compiled
+WorkGroupSize tuneWorkGroupSize(const std::string& filename,
+                                const std::vector<WorkGroupSize>& candidates,
+                                const std::function<void(Shader&)>& dispatch,
+                                const std::string& cacheFilename, int iterations = 10);
+
+} // namespace sh
+
+#ifdef SHADER_IMPLEMENTATION
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <cstdio>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef SHADER_IO_URING
+#include <liburing.h>
+#endif
+
+#ifdef SHADER_GLSLANG
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/Public/ResourceLimits.h>
+#endif
+
+namespace sh
+{
+    
+// metrics
+
+struct MetricCounters
+{
+    using Counter = std::atomic<std::uint64_t>;
+
+    Counter binds{0};
+    Counter bindsElided{0};
+    Counter uniformLookups{0};
+    Counter inactiveUniformLookups{0};
+    Counter uniformSets{0};
+    Counter uniformSetsSkipped{0};
+    Counter reloads{0};
+    Counter reloadFailures{0};
+    Counter cacheHits{0};
+    Counter cacheMisses{0};
+    Counter programBuilds{0};
+    Counter compileTime{0}; // us
+    Counter dispatchesRejected{0};
+};
+
+MetricCounters& getMetricCounters()
+{
+    static MetricCounters counters;
+    return counters;
+}
+
+void countMetric(MetricCounters::Counter& counter, std::uint64_t count = 1)
+{
+    counter.fetch_add(count, std::memory_order_relaxed);
+}
+
+// time in ms
+void countProgramBuild(double time)
+{
+    auto& counters = getMetricCounters();
+    countMetric(counters.programBuilds);
+    countMetric(counters.compileTime, static_cast<std::uint64_t>(time * 1000.0));
+}
+
+Metrics getMetrics(bool reset)
+{
+    auto get = [reset](MetricCounters::Counter& counter)
+    {
+        return reset ? counter.exchange(0, std::memory_order_relaxed) :
+                       counter.load(std::memory_order_relaxed);
+    };
+
+    auto& counters = getMetricCounters();
+    Metrics metrics;
+    metrics.binds = get(counters.binds);
+    metrics.bindsElided = get(counters.bindsElided);
+    metrics.uniformLookups = get(counters.uniformLookups);
+    metrics.inactiveUniformLookups = get(counters.inactiveUniformLookups);
+    metrics.uniformSets = get(counters.uniformSets);
+    metrics.uniformSetsSkipped = get(counters.uniformSetsSkipped);
+    metrics.reloads = get(counters.reloads);
+    metrics.reloadFailures = get(counters.reloadFailures);
+    metrics.cacheHits = get(counters.cacheHits);
+    metrics.cacheMisses = get(counters.cacheMisses);
+    metrics.programBuilds = get(counters.programBuilds);
+    metrics.compileTime = get(counters.compileTime) / 1000.0;
+    metrics.dispatchesRejected = get(counters.dispatchesRejected);
+    return metrics;
+}
+
+// bind elision (GL thread only)
+
+struct BoundProgram
+{
+    bool elision = false;
+    GLuint id = 0;
+    bool known = false; // id is what GL has bound
+};
+
+BoundProgram& getBoundProgram()
+{
+    static BoundProgram bound;
+    return bound;
+}
+
+void setBindElision(bool enabled)
+{
+    getBoundProgram() = {enabled, 0, false};
+}
+
+void invalidateBoundProgram() {getBoundProgram().known = false;}
+
+Shader::Program& Shader::Program::operator=(Program&& rhs)
+{
+    if(this == &rhs)
+        return *this;
+    if(id_)
+        deferDeletion(GL_PROGRAM, id_);
+    id_ = rhs.id_;
+    rhs.id_ = 0;
+    return *this;
+}
+
+struct DeletionQueue
+{
+    struct Object
+    {
+        GLenum type;
+        GLuint id;
+    };
+
+    struct Batch
+    {
+        GLsync fence;
+        std::vector<Object> objects;
+    };
+
+    bool enabled = false;
+    std::vector<Object> unfenced;
+    std::deque<Batch> batches;
+};
+
+DeletionQueue& getDeletionQueue()
+{
+    static DeletionQueue queue;
+    return queue;
+}
+
+// memory accounting
+
+struct ObjectTracker
+{
+    struct Objects
+    {
+        MemoryStats::Objects totals;
+        std::map<GLuint, std::size_t> sizes;
+    };
+
+    Objects programs;
+    Objects shaders;
+    Objects buffers;
+
+    Objects* get(GLenum type)
+    {
+        switch(type)
+        {
+            case GL_PROGRAM: return &programs;
+            case GL_SHADER:  return &shaders;
+            case GL_BUFFER:  return &buffers;
+            default:         return nullptr;
+        }
+    }
+};
+
+ObjectTracker& getObjectTracker()
+{
+    static ObjectTracker tracker;
+    return tracker;
+}
+
+// adds the object or updates its size
+void trackObject(GLenum type, GLuint id, std::size_t bytes)
+{
+    auto* objects = getObjectTracker().get(type);
+
+    if(!objects || !id)
+        return;
+
+    auto [it, inserted] = objects->sizes.emplace(id, 0);
+
+    if(inserted)
+        ++objects->totals.count;
+
+    objects->totals.bytes += bytes;
+    objects->totals.bytes -= it->second;
+    it->second = bytes;
+}
+
+void untrackObject(GLenum type, GLuint id)
+{
+    auto* objects = getObjectTracker().get(type);
+
+    if(!objects)
+        return;
+
+    if(auto it = objects->sizes.find(id); it != objects->sizes.end())
+    {
+        --objects->totals.count;
+        objects->totals.bytes -= it->second;
+        objects->sizes.erase(it);
+    }
+}
+
+MemoryStats getMemoryStats()
+{
+    auto& tracker = getObjectTracker();
+    return {tracker.programs.totals, tracker.shaders.totals, tracker.buffers.totals};
+}
+
+// linked programs only
+void trackProgramSize(GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    trackObject(GL_PROGRAM, program, length);
+}
+
+// object recycling
+
+struct ObjectPool
+{
+    std::size_t maxPooled = 0;
+    std::vector<GLuint> programs;
+    std::map<GLenum, std::vector<GLuint>> shaders; // by shader type
+    std::set<GLuint> spirvObjects; // not recycled, Mesa crashes on relinking them
+    RecyclingStats stats;
+};
+
+ObjectPool& getObjectPool()
+{
+    static ObjectPool pool;
+    return pool;
+}
+
+void setObjectRecycling(std::size_t maxPooled)
+{
+    auto& pool = getObjectPool();
+    pool.maxPooled = maxPooled;
+
+    while(pool.programs.size() > maxPooled)
+    {
+        glDeleteProgram(pool.programs.back());
+        pool.programs.pop_back();
+        --pool.stats.pooled;
+        ++pool.stats.deleted;
+    }
+
+    for(auto& [type, shaders]: pool.shaders)
+    {
+        while(shaders.size() > maxPooled)
+        {
+            glDeleteShader(shaders.back());
+            shaders.pop_back();
+            --pool.stats.pooled;
+            ++pool.stats.deleted;
+        }
+    }
+}
+
+RecyclingStats getRecyclingStats() {return getObjectPool().stats;}
+
+// recycled programs are reset to the state of a new program, except for the previous
+// link (replaced by the next glLinkProgram() or glProgramBinary())
+GLuint acquireProgram()
+{
+    auto& pool = getObjectPool();
+
+    if(pool.programs.empty())
+    {
+        ++pool.stats.programsCreated;
+        return glCreateProgram();
+    }
+
+    auto program = pool.programs.back();
+    pool.programs.pop_back();
+    --pool.stats.pooled;
+    ++pool.stats.programsReused;
+
+    glTransformFeedbackVaryings(program, 0, nullptr, GL_INTERLEAVED_ATTRIBS);
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_FALSE);
+    return program;
+}
+
+// source or SPIR-V binary of a recycled shader is replaced by the caller
+GLuint acquireShader(GLenum type)
+{
+    auto& pool = getObjectPool();
+    auto& shaders = pool.shaders[type];
+
+    if(shaders.empty())
+    {
+        ++pool.stats.shadersCreated;
+        return glCreateShader(type);
+    }
+
+    auto shader = shaders.back();
+    shaders.pop_back();
+    --pool.stats.pooled;
+    ++pool.stats.shadersReused;
+    return shader;
+}
+
+// returns false when the pool is full
+bool recycleObject(GLenum type, GLuint id)
+{
+    auto& pool = getObjectPool();
+
+    if(type == GL_BUFFER)
+        return false;
+
+    if(pool.spirvObjects.erase(id))
+    {
+        ++pool.stats.deleted;
+        return false;
+    }
+
+    if(type == GL_PROGRAM && pool.programs.size() < pool.maxPooled)
+    {
+        // shaders of builds abandoned before finishProgram()
+        GLuint shaders[8];
+        GLsizei count;
+
+        do
+        {
+            glGetAttachedShaders(id, 8, &count, shaders);
+
+            for(GLsizei i = 0; i < count; ++i)
+                glDetachShader(id, shaders[i]);
+
+        } while(count == 8);
+
+        pool.programs.push_back(id);
+        ++pool.stats.pooled;
+        return true;
+    }
+
+    if(type == GL_SHADER && pool.maxPooled)
+    {
+        GLint shaderType;
+        glGetShaderiv(id, GL_SHADER_TYPE, &shaderType);
+        auto& shaders = pool.shaders[shaderType];
+
+        if(shaders.size() < pool.maxPooled)
+        {
+            shaders.push_back(id);
+            ++pool.stats.pooled;
+            return true;
+        }
+    }
+
+    ++pool.stats.deleted;
+    return false;
+}
+
+void deleteObject(GLenum type, GLuint id)
+{
+    untrackObject(type, id);
+
+    // the name can come back with another program
+    if(type == GL_PROGRAM && getBoundProgram().id == id)
+        invalidateBoundProgram();
+
+    if(recycleObject(type, id))
+        return;
+
+    switch(type)
+    {
+        case GL_PROGRAM: glDeleteProgram(id); break;
+        case GL_SHADER:  glDeleteShader(id); break;
+        case GL_BUFFER:  glDeleteBuffers(1, &id); break;
+    }
+}
+
+Shader::Program::~Program() {if(id_) deferDeletion(GL_PROGRAM, id_);}
+
+// compiler release
+
+struct CompilerState
+{
+    bool released = false;
+    CompilerRelease mode = CompilerRelease::Refuse;
+};
+
+CompilerState& getCompilerState()
+{
+    static CompilerState state;
+    return state;
+}
+
+void releaseShaderCompiler(CompilerRelease mode)
+{
+    getCompilerState() = {true, mode};
+    glReleaseShaderCompiler();
+}
+
+void resumeCompilation() {getCompilerState().released = false;}
+
+bool isCompilationAllowed() {return !getCompilerState().released;}
+
+void setDeferredDeletion(bool enabled)
+{
+    auto& queue = getDeletionQueue();
+
+    if(!enabled && queue.enabled)
+    {
+        // fences the objects released since the last frame
+        processDeferredDeletions();
+
+        for(auto& batch: queue.batches)
+        {
+            glClientWaitSync(batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                             GL_TIMEOUT_IGNORED);
+        }
+
+        flushDeferredDeletions();
+    }
+
+    queue.enabled = enabled;
+}
+
+void deferDeletion(GLenum type, GLuint id)
+{
+    auto& queue = getDeletionQueue();
+
+    if(queue.enabled)
+        queue.unfenced.push_back({type, id});
+    else
+        deleteObject(type, id);
+}
+
+void processDeferredDeletions()
+{
+    auto& queue = getDeletionQueue();
+
+    if(queue.unfenced.size())
+    {
+        queue.batches.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+                                 std::move(queue.unfenced)});
+        queue.unfenced.clear();
+    }
+
+    while(queue.batches.size())
+    {
+        auto& batch = queue.batches.front();
+        auto status = glClientWaitSync(batch.fence, 0, 0);
+
+        if(status == GL_TIMEOUT_EXPIRED)
+            break;
+
+        for(auto& object: batch.objects)
+            deleteObject(object.type, object.id);
+
+        glDeleteSync(batch.fence);
+        queue.batches.pop_front();
+    }
+}
+
+void flushDeferredDeletions()
+{
+    auto& queue = getDeletionQueue();
+
+    for(auto& batch: queue.batches)
+    {
+        for(auto& object: batch.objects)
+            deleteObject(object.type, object.id);
+
+        glDeleteSync(batch.fence);
+    }
+
+    for(auto& object: queue.unfenced)
+        deleteObject(object.type, object.id);
+
+    queue.batches.clear();
+    queue.unfenced.clear();
+}
+
+// tracing
+
+#ifdef SHADER_TRACE
+
+struct Trace
+{
+    struct Event
+    {
+        const char* name;
+        std::string detail;
+        double start; // us since startTrace()
+        double duration;
+        int threadId;
+    };
+
+    std::mutex mutex;
+    std::atomic<bool> running{false};
+    std::string filename;
+    std::chrono::steady_clock::time_point start;
+    std::vector<Event> events;
+    std::atomic<int> threadCount{0};
+};
+
+Trace& getTrace()
+{
+    static Trace trace;
+    return trace;
+}
+
+int getTraceThreadId()
+{
+    thread_local const int threadId = ++getTrace().threadCount;
+    return threadId;
+}
+
+TraceScope::TraceScope(const char* name, std::string_view detail):
+    name_(name),
+    active_(getTrace().running.load(std::memory_order_relaxed))
+{
+    if(active_)
+    {
+        detail_ = detail;
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if(!active_)
+        return;
+
+    using Us = std::chrono::duration<double, std::micro>;
+    auto end = std::chrono::steady_clock::now();
+    auto& trace = getTrace();
+    auto threadId = getTraceThreadId();
+
+    std::lock_guard<std::mutex> lock(trace.mutex);
+
+    // stopped meanwhile
+    if(!trace.running)
+        return;
+
+    trace.events.push_back({name_, std::move(detail_), Us(start_ - trace.start).count(),
+                            Us(end - start_).count(), threadId});
+}
+
+std::string escapeJson(std::string_view string)
+{
+    std::string escaped;
+
+    for(auto c: string)
+    {
+        if(c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if(static_cast<unsigned char>(c) < 0x20)
+        {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else
+            escaped += c;
+    }
+
+    return escaped;
+}
+
+bool startTrace(const std::string& filename)
+{
+    auto& trace = getTrace();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+
+    if(trace.running)
+    {
+        std::cout << "sh::startTrace: trace already running" << std::endl;
+        return false;
+    }
+
+    trace.filename = filename;
+    trace.events.clear();
+    trace.start = std::chrono::steady_clock::now();
+    trace.running = true;
+    return true;
+}
+
+bool stopTrace()
+{
+    auto& trace = getTrace();
+    std::vector<Trace::Event> events;
+    std::string filename;
+
+    {
+        std::lock_guard<std::mutex> lock(trace.mutex);
+
+        if(!trace.running)
+            return false;
+
+        trace.running = false;
+        events = std::move(trace.events);
+        filename = trace.filename;
+        trace.events.clear();
+    }
+
+#ifdef __unix__
+    auto processId = static_cast<long long>(::getpid());
+#else
+    auto processId = 0ll;
+#endif
+
+    std::ofstream file(filename);
+    file << "{\"traceEvents\":[\n";
+
+    for(std::size_t i = 0; i < events.size(); ++i)
+    {
+        auto& event = events[i];
+        char timing[128];
+        std::snprintf(timing, sizeof(timing),
+                      "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lld,\"tid\":%d",
+                      event.start, event.duration, processId, event.threadId);
+
+        file << "{\"name\":\"" << escapeJson(event.name) << "\",\"cat\":\"sh\","
+             << "\"ph\":\"X\"," << timing;
+
+        if(event.detail.size())
+            file << ",\"args\":{\"detail\":\"" << escapeJson(event.detail) << "\"}";
+
+        file << (i + 1 < events.size() ? "},\n" : "}\n");
+    }
+
+    file << "],\"displayTimeUnit\":\"ms\"}\n";
+
+    if(!file)
+    {
+        std::cout << "sh::stopTrace: could not write file = " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+#else
+
+bool startTrace(const std::string&)
+{
+    std::cout << "sh::startTrace: SHADER_TRACE is not defined" << std::endl;
+    return false;
+}
+
+bool stopTrace() {return false;}
+
+#endif // SHADER_TRACE
+
+std::uint64_t hashFnv1a(std::string_view data, std::uint64_t hash)
+{
+    for(auto c: data)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// virtual filesystem
+
+struct Mount
+{
+    struct File
+    {
+        std::string contents;
+        fs::file_time_type lastWriteTime;
+        std::uint64_t contentHash = 0; // memory mounts, stable across runs
+    };
+
+    std::string mountPoint; // "" or ends with '/', full path for memory mounts
+    std::optional<std::string> directory; // std::nullopt for memory and pack mounts
+    std::map<std::string, File> files; // path inside the mount -> file
+};
+
+struct Vfs
+{
+    Vfs() {mounts.push_back({"", std::string(), {}});}
+
+    std::mutex mutex;
+    std::vector<Mount> mounts;
+    std::map<std::string, std::size_t> lookups; // path -> index in mounts
+    std::map<std::string, Mount::File> preloaded; // see Preload
+};
+
+Vfs& getVfs()
+{
+    static Vfs vfs;
+    return vfs;
+}
+
+std::string getDiskPath(const Mount& mount, const std::string& path)
+{
+    auto relative = path.substr(mount.mountPoint.size());
+
+    if(mount.directory->empty())
+        return relative;
+
+    return *mount.directory + '/' + relative;
+}
+
+// vfs.mutex must be locked, returns nullptr if path is not found
+const Mount* findMount(Vfs& vfs, const std::string& path)
+{
+    if(auto it = vfs.lookups.find(path); it != vfs.lookups.end())
+        return &vfs.mounts[it->second];
+
+    for(auto i = vfs.mounts.size(); i-- > 0;)
+    {
+        auto& mount = vfs.mounts[i];
+
+        if(path.compare(0, mount.mountPoint.size(), mount.mountPoint) != 0)
+            continue;
+
+        bool found;
+
+        if(mount.directory)
+        {
+            std::error_code ec;
+            found = fs::is_regular_file(getDiskPath(mount, path), ec);
+        }
+        else
+            found = mount.files.count(path.substr(mount.mountPoint.size()));
+
+        if(found)
+        {
+            vfs.lookups[path] = i;
+            return &mount;
+        }
+    }
+
+    return nullptr;
+}
+
+// vfs.mutex must be locked
+void invalidateLookups(Vfs& vfs)
+{
+    vfs.lookups.clear();
+    vfs.preloaded.clear();
+}
+
+std::string getMountPoint(std::string mountPoint)
+{
+    if(mountPoint.size() && mountPoint.back() != '/')
+        mountPoint += '/';
+
+    return mountPoint;
+}
+
+void mountDirectory(const std::string& mountPoint, const std::string& directory)
+{
+    auto& vfs = getVfs();
+    std::lock_guard<std::mutex> lock(vfs.mutex);
+    vfs.mounts.push_back({getMountPoint(mountPoint), directory, {}});
+    invalidateLookups(vfs);
+}
+
+void mountMemory(const std::string& path, std::string contents)
+{
+    auto& vfs = getVfs();
+    std::lock_guard<std::mutex> lock(vfs.mutex);
+    auto hash = hashFnv1a(contents);
+    Mount::File file{std::move(contents), fs::file_time_type::clock::now(), hash};
+
+    for(auto& mount: vfs.mounts)
+    {
+        if(!mount.directory && mount.mountPoint == path && mount.files.count(""))
+        {
+            mount.files[""] = std::move(file);
+            vfs.preloaded.erase(path);
+            return;
+        }
+    }
+
+    vfs.mounts.push_back({path, std::nullopt, {}});
+    vfs.mounts.back().files[""] = std::move(file);
+    invalidateLookups(vfs);
+}
+
+std::optional<fs::file_time_type> getLastWriteTime(const std::string& path);
+
+bool mountPack(const std::string& mountPoint, const std::string& filename)
+{
+    auto pack = readFile(filename);
+
+    static const std::string header = "SHPACK1\n";
+
+    if(!pack || pack->compare(0, header.size(), header) != 0)
+    {
+        std::cout << "sh::mountPack: invalid pack, file = " << filename << std::endl;
+        return false;
+    }
+
+    Mount mount{getMountPoint(mountPoint), std::nullopt, {}};
+    auto time = getLastWriteTime(filename).value_or(fs::file_time_type::clock::now());
+    auto pos = header.size();
+
+    while(pos < pack->size())
+    {
+        auto pathLast = pack->find('\n', pos);
+
+        if(pathLast == std::string::npos)
+            break;
+
+        auto sizeLast = pack->find('\n', pathLast + 1);
+
+        if(sizeLast == std::string::npos)
+            break;
+
+        // the size line must be digits only
+        auto sizeFirst = pack->c_str() + pathLast + 1;
+        char* sizeEnd;
+        auto size = std::strtoull(sizeFirst, &sizeEnd, 10);
+
+        if(!std::isdigit(static_cast<unsigned char>(*sizeFirst)) ||
+           sizeEnd != pack->c_str() + sizeLast)
+        {
+            break;
+        }
+
+        auto path = pack->substr(pos, pathLast - pos);
+        pos = sizeLast + 1;
+
+        if(size > pack->size() - pos)
+            break;
+
+        mount.files[path] = {pack->substr(pos, size), time, 0};
+        pos += size;
+    }
+
+    if(pos != pack->size())
+    {
+        std::cout << "sh::mountPack: truncated or corrupt pack, file = " << filename
+                  << std::endl;
+        return false;
+    }
+
+    auto& vfs = getVfs();
+    std::lock_guard<std::mutex> lock(vfs.mutex);
+    vfs.mounts.push_back(std::move(mount));
+    invalidateLookups(vfs);
+    return true;
+}
+
+void clearMounts()
+{
+    auto& vfs = getVfs();
+    std::lock_guard<std::mutex> lock(vfs.mutex);
+    vfs.mounts.resize(1);
+    invalidateLookups(vfs);
+}
+
+std::optional<std::string> readFile(const std::string& path)
+{
+    SH_TRACE_SCOPE("read file", path);
+    auto& vfs = getVfs();
+    std::string diskPath;
+
+    {
+        std::lock_guard<std::mutex> lock(vfs.mutex);
+
+        if(auto it = vfs.preloaded.find(path); it != vfs.preloaded.end())
+            return it->second.contents;
+
+        auto* mount = findMount(vfs, path);
+
+        if(!mount)
+            return {};
+
+        if(!mount->directory)
+            return mount->files.at(path.substr(mount->mountPoint.size())).contents;
+
+        diskPath = getDiskPath(*mount, path);
+    }
+
+    std::ifstream file(diskPath, std::ios::binary);
+
+    if(!file.is_open())
+    {
+        std::lock_guard<std::mutex> lock(vfs.mutex);
+        vfs.lookups.erase(path); // removed from disk
+        return {};
+    }
+
+    std::stringstream stringstream;
+    stringstream << file.rdbuf();
+    return stringstream.str();
+}
+
+std::optional<fs::file_time_type> getLastWriteTime(const std::string& path)
+{
+    auto& vfs = getVfs();
+    std::string diskPath;
+
+    {
+        std::lock_guard<std::mutex> lock(vfs.mutex);
+
+        if(auto it = vfs.preloaded.find(path); it != vfs.preloaded.end())
+            return it->second.lastWriteTime;
+
+        auto* mount = findMount(vfs, path);
+
+        if(!mount)
+            return {};
+
+        if(!mount->directory)
+            return mount->files.at(path.substr(mount->mountPoint.size())).lastWriteTime;
+
+        diskPath = getDiskPath(*mount, path);
+    }
+
+    std::error_code ec;
+    auto time = fs::last_write_time(diskPath, ec);
+
+    if(ec)
+        return {};
+
+    return time;
+}
+
+struct FileStatus
+{
+    fs::file_time_type lastWriteTime;
+    std::uintmax_t size;
+    std::uint64_t contentHash; // memory mounts, 0 otherwise
+};
+
+std::optional<FileStatus> getFileStatus(const std::string& path)
+{
+    auto& vfs = getVfs();
+    std::string diskPath;
+
+    {
+        std::lock_guard<std::mutex> lock(vfs.mutex);
+        const Mount::File* file = nullptr;
+
+        if(auto it = vfs.preloaded.find(path); it != vfs.preloaded.end())
+            file = &it->second;
+        else if(auto* mount = findMount(vfs, path); !mount)
+            return {};
+        else if(!mount->directory)
+            file = &mount->files.at(path.substr(mount->mountPoint.size()));
+        else
+            diskPath = getDiskPath(*mount, path);
+
+        if(file)
+            return FileStatus{file->lastWriteTime, file->contents.size(),
+                              file->contentHash};
+    }
+
+    std::error_code ec;
+    auto time = fs::last_write_time(diskPath, ec);
+
+    if(ec)
+        return {};
+
+    auto size = fs::file_size(diskPath, ec);
+
+    if(ec)
+        return {};
+
+    return FileStatus{time, size, 0};
+}
+
+bool writePack(const std::string& filename, const std::vector<std::string>& paths)
+{
+    std::string pack = "SHPACK1\n";
+
+    for(auto& path: paths)
+    {
+        auto contents = readFile(path);
+
+        if(!contents)
+        {
+            std::cout << "sh::writePack: could not open file = " << path << std::endl;
+            return false;
+        }
+
+        pack += path + '\n' + std::to_string(contents->size()) + '\n' + *contents;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    file << pack;
+
+    if(!file)
+    {
+        std::cout << "sh::writePack: could not write file = " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// '*' matches any sequence, '?' any character
+bool matchPattern(std::string_view name, std::string_view pattern)
+{
+    std::size_t n = 0, p = 0;
+    auto starP = std::string_view::npos;
+    std::size_t starN = 0;
+
+    while(n < name.size())
+    {
+        if(p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+        {
+            ++n;
+            ++p;
+        }
+        else if(p < pattern.size() && pattern[p] == '*')
+        {
+            starP = p++;
+            starN = n;
+        }
+        else if(starP != std::string_view::npos) // backtrack, '*' takes one more char
+        {
+            p = starP + 1;
+            n = ++starN;
+        }
+        else
+            return false;
+    }
+
+    while(p < pattern.size() && pattern[p] == '*')
+        ++p;
+
+    return p == pattern.size();
+}
+
+std::vector<std::string> listDirectory(const std::string& directory,
+                                       const std::string& pattern)
+{
+    std::vector<std::string> filenames;
+    std::error_code ec;
+
+    for(fs::recursive_directory_iterator it(directory, ec), end; !ec && it != end;
+        it.increment(ec))
+    {
+        std::error_code statusEc;
+
+        if(fs::is_regular_file(it->status(statusEc)) &&
+           matchPattern(it->path().filename().string(), pattern))
+        {
+            filenames.push_back(it->path().string());
+        }
+    }
+
+    if(ec)
+        std::cout << "sh::listDirectory: could not list directory = " << directory
+                  << std::endl;
+
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+}
+
+ThreadPool::ThreadPool(int threadCount)
+{
+    if(threadCount <= 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for(int i = 0; i < threadCount; ++i)
+        queues_.push_back(std::make_unique<Queue>());
+
+    for(int i = 0; i < threadCount; ++i)
+        threads_.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+
+    taskAvailable_.notify_all();
+
+    for(auto& thread: threads_)
+        thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    ++pending_;
+
+    {
+        auto& queue = *queues_[nextQueue_++ % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        ++queued_;
+    }
+
+    // workers check queued_ with mutex_ locked, no wakeup can be lost
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+
+    taskAvailable_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasksDone_.wait(lock, [this] {return pending_ == 0;});
+}
+
+std::function<void()> ThreadPool::pop(std::size_t queueIndex)
+{
+    for(std::size_t i = 0; i < queues_.size(); ++i)
+    {
+        auto& queue = *queues_[(queueIndex + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if(queue.tasks.empty())
+            continue;
+
+        std::function<void()> task;
+
+        if(i == 0)
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        else
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+
+        --queued_;
+        return task;
+    }
+
+    return {};
+}
+
+void ThreadPool::run(std::size_t queueIndex)
+{
+    for(;;)
+    {
+        if(auto task = pop(queueIndex))
+        {
+            task();
+
+            if(--pending_ == 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasksDone_.notify_all();
+            }
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        taskAvailable_.wait(lock, [this] {return stop_ || queued_ > 0;});
+
+        if(stop_ && queued_ == 0)
+            return;
+    }
+}
+
+// the workers of parallelFor(), started on first use
+ThreadPool& getIoThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+// runs function(0) ... function(count - 1) on the caller and getIoThreadPool()
+void parallelFor(std::size_t count, const std::function<void(std::size_t)>& function)
+{
+    auto& pool = getIoThreadPool();
+    std::atomic<std::size_t> next(0);
+
+    auto worker = [&]
+    {
+        for(auto i = next++; i < count; i = next++)
+            function(i);
+    };
+
+    // not pool.wait(), other callers may share the pool
+    auto taskCount = std::min<std::size_t>(pool.getThreadCount() - 1, count);
+    std::size_t running = taskCount;
+    std::mutex mutex;
+    std::condition_variable tasksDone;
+
+    for(std::size_t i = 0; i < taskCount; ++i)
+    {
+        pool.submit([&]
+        {
+            worker();
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if(--running == 0)
+                tasksDone.notify_one();
+        });
+    }
+
+    worker();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    tasksDone.wait(lock, [&] {return running == 0;});
+}
+
+struct FileRead
+{
+    std::string diskPath;
+    Mount::File file;
+    bool done = false;
+};
+
+void readFilesWithThreads(std::vector<FileRead>& reads)
+{
+    parallelFor(reads.size(), [&reads](std::size_t i)
+    {
+        auto& read = reads[i];
+        std::error_code ec;
+        read.file.lastWriteTime = fs::last_write_time(read.diskPath, ec);
+
+        std::ifstream file(read.diskPath, std::ios::binary);
+
+        if(ec || !file.is_open())
+            return;
+
+        std::stringstream stringstream;
+        stringstream << file.rdbuf();
+        read.file.contents = stringstream.str();
+        read.done = true;
+    });
+}
+
+#ifdef SHADER_IO_URING
+
+// submits the queued requests and calls handle(user data, result) for each of them
+// returns false if a completion could not be waited for
+template<typename F>
+bool completeRequests(io_uring& ring, unsigned count, F handle)
+{
+    io_uring_submit(&ring);
+
+    for(unsigned i = 0; i < count; ++i)
+    {
+        io_uring_cqe* cqe;
+        int result;
+
+        while((result = io_uring_wait_cqe(&ring, &cqe)) == -EINTR)
+            ;
+
+        // what has completed is still handled, so opened files can be closed
+        if(result < 0)
+        {
+            while(io_uring_peek_cqe(&ring, &cqe) == 0)
+            {
+                handle(reinterpret_cast<std::uintptr_t>(io_uring_cqe_get_data(cqe)),
+                       cqe->res);
+                io_uring_cqe_seen(&ring, cqe);
+            }
+
+            return false;
+        }
+
+        handle(reinterpret_cast<std::uintptr_t>(io_uring_cqe_get_data(cqe)), cqe->res);
+        io_uring_cqe_seen(&ring, cqe);
+    }
+
+    return true;
+}
+
+// closes the files opened by a failed batch
+void closeFiles(const std::vector<int>& fds)
+{
+    for(auto fd: fds)
+    {
+        if(fd >= 0)
+            close(fd);
+    }
+}
+
+// per batch: openat + statx, then read, then close, each in one submission
+// returns false if io_uring is not available
+bool readFilesWithIoUring(std::vector<FileRead>& reads)
+{
+    static constexpr unsigned queueDepth = 256;
+    static constexpr std::size_t batchSize = queueDepth / 2; // openat + statx per file
+
+    io_uring ring;
+
+    if(io_uring_queue_init(queueDepth, &ring, 0) < 0)
+        return false;
+
+    for(std::size_t first = 0; first < reads.size(); first += batchSize)
+    {
+        auto count = std::min(batchSize, reads.size() - first);
+        std::vector<int> fds(count, -1);
+        std::vector<struct statx> stats(count);
+        std::vector<bool> statted(count, false);
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            auto* path = reads[first + i].diskPath.c_str();
+
+            auto* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_openat(sqe, AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i * 2));
+
+            sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_statx(sqe, AT_FDCWD, path, 0, STATX_SIZE | STATX_MTIME,
+                                &stats[i]);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i * 2 + 1));
+        }
+
+        auto opened = completeRequests(ring, count * 2,
+                                       [&](std::uintptr_t data, int result)
+        {
+            if(data % 2)
+                statted[data / 2] = result == 0;
+            else
+                fds[data / 2] = result;
+        });
+
+        // the files left are read by readFile()
+        if(!opened)
+        {
+            closeFiles(fds);
+            break;
+        }
+
+        unsigned readCount = 0;
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            if(fds[i] < 0 || !statted[i])
+                continue;
+
+            auto& read = reads[first + i];
+            read.file.contents.resize(stats[i].stx_size);
+
+            read.file.lastWriteTime = fs::file_time_type(
+                std::chrono::duration_cast<fs::file_time_type::duration>(
+                    std::chrono::seconds(stats[i].stx_mtime.tv_sec) +
+                    std::chrono::nanoseconds(stats[i].stx_mtime.tv_nsec)));
+
+            auto* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_read(sqe, fds[i], read.file.contents.data(),
+                               read.file.contents.size(), 0);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i));
+            ++readCount;
+        }
+
+        // short reads are left to readFile()
+        auto readDone = completeRequests(ring, readCount,
+                                         [&](std::uintptr_t data, int result)
+        {
+            auto& read = reads[first + data];
+            read.done = result >= 0 &&
+                        static_cast<std::size_t>(result) == read.file.contents.size();
+        });
+
+        if(!readDone)
+        {
+            closeFiles(fds);
+            break;
+        }
+
+        unsigned closeCount = 0;
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            if(fds[i] < 0)
+                continue;
+
+            auto* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_close(sqe, fds[i]);
+            io_uring_sqe_set_data(sqe, nullptr);
+            ++closeCount;
+        }
+
+        if(!completeRequests(ring, closeCount, [](std::uintptr_t, int) {}))
+            break;
+    }
+
+    io_uring_queue_exit(&ring);
+    return true;
+}
+
+#endif // SHADER_IO_URING
+
+// adds the quoted paths of INCLUDE lines
+void getIncludes(const std::string& source, std::vector<std::string>& includes)
+{
+    static const std::string includeDirective = "INCLUDE";
+
+    for(auto pos = source.find(includeDirective); pos != std::string::npos;
+        pos = source.find(includeDirective, pos + includeDirective.size()))
+    {
+        auto lineLast = source.find('\n', pos);
+        auto filenameFirst = source.find('"', pos + includeDirective.size());
+
+        if(filenameFirst >= lineLast)
+            continue;
+
+        auto filenameLast = source.find('"', filenameFirst + 1);
+
+        if(filenameLast >= lineLast)
+            continue;
+
+        includes.push_back(source.substr(filenameFirst + 1,
+                                         filenameLast - filenameFirst - 1));
+    }
+}
+
+// each round reads the includes found in the previous one
+Preload::Preload(const std::vector<std::string>& paths)
+{
+    auto& vfs = getVfs();
+    std::set<std::string> visited;
+    auto round = paths;
+
+    while(round.size())
+    {
+        std::vector<std::string> readPaths;
+        std::vector<FileRead> reads;
+        std::vector<std::string> includes;
+
+        {
+            std::lock_guard<std::mutex> lock(vfs.mutex);
+
+            for(auto& path: round)
+            {
+                if(!visited.insert(path).second)
+                    continue;
+
+                auto* mount = findMount(vfs, path);
+
+                if(!mount)
+                    continue;
+
+                if(mount->directory)
+                {
+                    readPaths.push_back(path);
+                    reads.push_back({getDiskPath(*mount, path), {}});
+                }
+                else
+                {
+                    auto& file = mount->files.at(path.substr(mount->mountPoint.size()));
+                    getIncludes(file.contents, includes);
+                }
+            }
+        }
+
+#ifdef SHADER_IO_URING
+        if(!readFilesWithIoUring(reads))
+#endif
+        readFilesWithThreads(reads);
+
+        std::lock_guard<std::mutex> lock(vfs.mutex);
+
+        for(std::size_t i = 0; i < reads.size(); ++i)
+        {
+            if(!reads[i].done)
+                continue;
+
+            getIncludes(reads[i].file.contents, includes);
+            ++fileCount_;
+            byteCount_ += reads[i].file.contents.size();
+            vfs.preloaded[readPaths[i]] = std::move(reads[i].file);
+        }
+
+        round = std::move(includes);
+    }
+}
+
+Preload::~Preload()
+{
+    auto& vfs = getVfs();
+    std::lock_guard<std::mutex> lock(vfs.mutex);
+    vfs.preloaded.clear();
+}
+
+struct SourceDependency
+{
+    std::string path;
+    FileStatus status; // before the file was read
+};
+
+// dependencies: filename and the files it INCLUDEs, if not nullptr
+std::string loadSourceFromFile(const std::string& filename,
+                               std::vector<SourceDependency>* dependencies = nullptr)
+{
+    SH_TRACE_SCOPE("include expansion", filename);
+
+    if(dependencies)
+    {
+        if(auto status = getFileStatus(filename))
+            dependencies->push_back({filename, *status});
+    }
+
+    auto file = readFile(filename);
+
+    if(!file)
+    {
+        std::cout << "sh::Shader: could not open file = " << filename << std::endl;
+        return {};
+    }
+
+    auto source = std::move(*file);
+    
+    static const std::string includeDirective = "INCLUDE";
+
+    auto lineFirst = source.find(includeDirective);
+
+    if(lineFirst != std::string::npos)
+    {
+        auto lineLast = source.find('\n', lineFirst) + 1;
+
+        auto filenameFirst = source.find('"', lineFirst + includeDirective.size()) + 1;
+
+        auto filenameCount = source.find('"', filenameFirst) - filenameFirst;
+        
+        source.insert(lineLast,
+                      loadSourceFromFile(source.substr(filenameFirst, filenameCount),
+                                         dependencies));
+
+        source.erase(lineFirst, lineLast - lineFirst);
+    }
+
+    return source;
+}
+
+fs::file_time_type getFileLastWriteTime(const std::string& filename)
+{
+    auto time = getLastWriteTime(filename);
+
+    if(!time)
+    {
+        std::cout << "sh::Shader: last_write_time() failed, file = "
+                  << filename << std::endl;
+
+        return fs::file_time_type::min();
+    }
+
+    return *time;
+}
+
+struct PreprocessedFile
+{
+    std::string source; // after INCLUDE expansion
+    std::vector<StageSource> stages;
+};
+
+std::optional<PreprocessedFile> preprocessFile(const std::string& filename,
+                                               const Defines& defines);
+
+#ifdef SHADER_GLSLANG
+bool validateSource(const std::vector<StageSource>& stages, const std::string& id);
+#endif
+
+Defines addTunedWorkGroupSize(const std::string& filename, const Defines& defines);
+
+Shader::Shader(const std::string& filename, bool hotReload, const Defines& defines):
+    id_(filename),
+    hotReload_(hotReload),
+    defines_(addTunedWorkGroupSize(filename, defines))
+{
+    fileLastWriteTime_ = getFileLastWriteTime(filename);
+    swapProgramFromFile();
+}
+
+Shader::Shader(const std::string& source, const char* id, const Defines& defines):
+    id_(id),
+    hotReload_(false),
+    defines_(defines)
+{
+    swapProgram(source);
+}
+
+Shader::Shader(const std::string& filename, bool hotReload, const Defines& defines,
+               fs::file_time_type fileLastWriteTime, const std::string& source,
+               GLuint program, const UniformTable* uniforms):
+    id_(filename),
+    hotReload_(hotReload),
+    fileLastWriteTime_(fileLastWriteTime),
+    defines_(defines)
+{
+    setProgram(program, source, uniforms);
+}
+
+Shader::Shader(const std::vector<SpirvStage>& stages, const char* id):
+    id_(id),
+    hotReload_(false),
+    spirvStages_(stages)
+{
+    swapProgram({});
+}
+
+void Shader::bind()
+{
+    if(compileDeferred_ && isCompilationAllowed())
+    {
+        compileDeferred_ = false;
+        swapProgram(std::exchange(deferredSource_, {}));
+    }
+
+    if(hotReload_)
+    {
+#ifdef SHADER_GLSLANG
+        if(validation_.valid())
+        {
+            using namespace std::chrono_literals;
+
+            if(validation_.wait_for(0s) == std::future_status::ready)
+            {
+                auto validation = validation_.get();
+
+                if(validation.valid && swapProgram(validation.stages, validation.source))
+                {
+                    std::cout << "sh::Shader, " << id_
+                              << ": hot reload succeeded" << std::endl;
+                }
+                else
+                    countMetric(getMetricCounters().reloadFailures);
+            }
+        }
+        else
+#endif
+        if(auto time = getFileLastWriteTime(id_); time > fileLastWriteTime_)
+        {
+            fileLastWriteTime_ = time;
+            countMetric(getMetricCounters().reloads);
+
+#ifdef SHADER_GLSLANG
+            // preprocessed through the source cache, the stages are reused by the
+            // program build
+            validation_ = std::async(std::launch::async, [defines = defines_, id = id_]
+            {
+                auto preprocessed = preprocessFile(id, defines);
+
+                if(!preprocessed)
+                    return Validation{{}, {}, false};
+
+                auto valid = validateSource(preprocessed->stages, id);
+                return Validation{std::move(preprocessed->source),
+                                  std::move(preprocessed->stages), valid};
+            });
+#else
+            if(swapProgramFromFile())
+                std::cout << "sh::Shader, " << id_ << ": hot reload succeeded" << std::endl;
+            else
+                countMetric(getMetricCounters().reloadFailures);
+#endif
+        }
+    }
+
+    if((variantDirty_ || variant_) && updateVariant())
+        notifyProgramChanged();
+
+    auto program = getActiveProgramId();
+    auto& bound = getBoundProgram();
+    countMetric(getMetricCounters().binds);
+
+    if(bound.elision && bound.known && bound.id == program)
+    {
+        countMetric(getMetricCounters().bindsElided);
+        return;
+    }
+
+    glUseProgram(program);
+    bound.id = program;
+    bound.known = true;
+}
+
+GLint Shader::getUniformLocation(const std::string& uniformName) const
+{
+    auto& uniforms = isVariantActive() ? variant_->uniforms : uniforms_;
+
+    auto it = uniforms.find(uniformName);
+    countMetric(getMetricCounters().uniformLookups);
+
+    if(it != uniforms.end())
+        return it->second.location;
+
+    if(isVariantActive() && specializations_.count(uniformName))
+        return -1;
+
+    countMetric(getMetricCounters().inactiveUniformLookups);
+
+    if(inactiveUniforms_.find(uniformName) == inactiveUniforms_.end())
+    {
+        std::cout << "sh::Shader, " << id_ << ": inactive uniform = "
+                  << uniformName << std::endl;
+
+        inactiveUniforms_.insert(uniformName);
+    }
+
+    return -1;
+}
+
+// samplers, images and atomic counters, set as GLint
+bool isOpaqueType(GLenum type)
+{
+    return (type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_RECT_SHADOW) ||
+           (type >= GL_SAMPLER_1D_ARRAY && type <= GL_SAMPLER_CUBE_SHADOW) ||
+           (type >= GL_INT_SAMPLER_1D && type <= GL_UNSIGNED_INT_SAMPLER_BUFFER) ||
+           (type >= GL_SAMPLER_CUBE_MAP_ARRAY &&
+            type <= GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY) ||
+           (type >= GL_IMAGE_1D && type <= GL_UNSIGNED_INT_IMAGE_2D_MULTISAMPLE_ARRAY) ||
+           (type >= GL_SAMPLER_2D_MULTISAMPLE &&
+            type <= GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY) ||
+           type == GL_UNSIGNED_INT_ATOMIC_COUNTER;
+}
+
+GLint Shader::validateUniform(const char* uniformName, GLenum type) const
+{
+    auto& uniforms = isVariantActive() ? variant_->uniforms : uniforms_;
+    auto it = uniforms.find(uniformName);
+
+    if(it == uniforms.end())
+        it = uniforms.find(uniformName + std::string("[0]"));
+
+    if(it == uniforms.end())
+    {
+        if(!isVariantActive() || !specializations_.count(uniformName))
+        {
+            std::cout << "sh::Shader, " << id_ << ": inactive uniform = " << uniformName
+                      << std::endl;
+        }
+
+        return -1;
+    }
+
+    auto match = it->second.type == type ||
+                 (type == GL_INT && isOpaqueType(it->second.type));
+
+    if(!match)
+    {
+        std::cout << "sh::Shader, " << id_ << ": uniform = " << uniformName
+                  << " declared with type 0x" << std::hex << it->second.type
+                  << ", expected 0x" << type << std::dec << std::endl;
+
+        return -1;
+    }
+
+    return it->second.location;
+}
+
+// returns false for uniforms that failed validation (location -1)
+bool countUniformSet(GLint location)
+{
+    auto& counters = getMetricCounters();
+
+    if(location < 0)
+    {
+        countMetric(counters.uniformSetsSkipped);
+        return false;
+    }
+
+    countMetric(counters.uniformSets);
+    return true;
+}
+
+void setUniform(GLuint program, GLint location, GLfloat value)
+{
+    glProgramUniform1f(program, location, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[2])
+{
+    glProgramUniform2fv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[3])
+{
+    glProgramUniform3fv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[4])
+{
+    glProgramUniform4fv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, GLint value)
+{
+    glProgramUniform1i(program, location, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLint (&value)[2])
+{
+    glProgramUniform2iv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLint (&value)[3])
+{
+    glProgramUniform3iv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLint (&value)[4])
+{
+    glProgramUniform4iv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, GLuint value)
+{
+    glProgramUniform1ui(program, location, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLuint (&value)[2])
+{
+    glProgramUniform2uiv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLuint (&value)[3])
+{
+    glProgramUniform3uiv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLuint (&value)[4])
+{
+    glProgramUniform4uiv(program, location, 1, value);
+}
+
+void setUniform(GLuint program, GLint location, bool value)
+{
+    glProgramUniform1i(program, location, value);
+}
+
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[2][2])
+{
+    glProgramUniformMatrix2fv(program, location, 1, GL_FALSE, &value[0][0]);
+}
+
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[3][3])
+{
+    glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, &value[0][0]);
+}
+
+void setUniform(GLuint program, GLint location, const GLfloat (&value)[4][4])
+{
+    glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, &value[0][0]);
+}
+
+void Shader::reload()
+{
+    SH_TRACE_SCOPE("reload", id_);
+    countMetric(getMetricCounters().reloads);
+    auto success = false;
+
+    if(spirvStages_.size())
+        success = swapProgram({});
+    else
+    {
+        if(auto time = getFileLastWriteTime(id_); time > fileLastWriteTime_)
+            fileLastWriteTime_ = time;
+
+        success = swapProgramFromFile();
+    }
+
+    if(success)
+        std::cout << "sh::Shader, " << id_ << ": reload succeeded" << std::endl;
+    else
+        countMetric(getMetricCounters().reloadFailures);
+}
+
+template<bool isProgram>
+std::optional<std::string> getError(GLuint id, GLenum flag)
+{
+    GLint success;
+
+    if constexpr (isProgram)
+        glGetProgramiv(id, flag, &success);
+    else
+        glGetShaderiv(id, flag, &success);
+
+    if(success == GL_TRUE)
+        return {};
+
+    GLint length;
+    if constexpr (isProgram)
+        glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
+    else
+        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+
+    if(!length)
+        return "";
+
+    --length;
+    std::string log(length, '\0');
+
+    if constexpr (isProgram)
+        glGetProgramInfoLog(id, length, nullptr, log.data());
+    else
+        glGetShaderInfoLog(id, length, nullptr, log.data());
+
+    return log;
+}
+
+// shader must be cleaned by caller with deleteObject()
+GLuint createAndCompileShader(GLenum type, const std::string& source)
+{
+    auto id = acquireShader(type);
+    trackObject(GL_SHADER, id, source.size());
+    auto* str = source.c_str();
+    glShaderSource(id, 1, &str, nullptr);
+    glCompileShader(id);
+    return id;
+}
+
+// conditional pruning
+
+bool& getConditionalPruning()
+{
+    static bool enabled = false;
+    return enabled;
+}
+
+void setConditionalPruning(bool enabled) {getConditionalPruning() = enabled;}
+
+// macros predefined by the driver (GL_core_profile, __VERSION__, extensions, ...)
+bool isBuiltinMacro(const std::string& name)
+{
+    return name.compare(0, 3, "GL_") == 0 || name.compare(0, 2, "__") == 0;
+}
+
+struct Macro
+{
+    bool known; // false if defined or undefined in a branch left to the driver
+    std::optional<std::string> value; // std::nullopt for function-like macros
+};
+
+using Macros = std::map<std::string, Macro>;
+
+// 1 if defined, 0 if not, std::nullopt if undecidable
+std::optional<long long> isMacroDefined(const Macros& macros, const std::string& name)
+{
+    if(auto it = macros.find(name); it != macros.end())
+        return it->second.known ? std::optional<long long>(1) : std::nullopt;
+
+    if(name.empty() || isBuiltinMacro(name))
+        return {};
+
+    return 0;
+}
+
+// evaluates #if / #elif expressions, std::nullopt if undecidable or malformed
+class ConditionEvaluator
+{
+public:
+    ConditionEvaluator(const Macros& macros): macros_(macros) {}
+
+    std::optional<long long> evaluate(const std::string& expression)
+    {
+        tokens_.clear();
+        pos_ = 0;
+        error_ = false;
+
+        tokenize(expression, 0);
+
+        if(error_ || tokens_.empty())
+            return {};
+
+        auto value = parseBinary(0);
+
+        if(error_ || pos_ != tokens_.size())
+            return {};
+
+        return value;
+    }
+
+private:
+    using Value = std::optional<long long>;
+
+    struct Token
+    {
+        enum Type {Number, Unknown, Operator} type;
+        long long value;
+        std::string op;
+    };
+
+    const Macros& macros_;
+    std::vector<Token> tokens_;
+    std::size_t pos_;
+    bool error_;
+
+    static bool isSpace(char c) {return std::isspace(static_cast<unsigned char>(c));}
+
+    static bool isIdentifierChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    void tokenize(const std::string& text, int depth)
+    {
+        if(depth > 32)
+        {
+            error_ = true;
+            return;
+        }
+
+        for(std::size_t i = 0; i < text.size() && !error_;)
+        {
+            auto c = text[i];
+
+            if(isSpace(c))
+            {
+                ++i;
+                continue;
+            }
+
+            if(std::isdigit(static_cast<unsigned char>(c)))
+            {
+                char* end;
+                errno = 0;
+                auto value = std::strtoll(text.c_str() + i, &end, 0);
+                auto outOfRange = errno == ERANGE;
+                i = end - text.c_str();
+
+                while(i < text.size() && (text[i] == 'u' || text[i] == 'U'))
+                    ++i;
+
+                if(i < text.size() && isIdentifierChar(text[i]))
+                    error_ = true;
+
+                if(outOfRange)
+                    tokens_.push_back({Token::Unknown, 0, {}});
+                else
+                    tokens_.push_back({Token::Number, value, {}});
+
+                continue;
+            }
+
+            if(isIdentifierChar(c))
+            {
+                auto end = i;
+                while(end < text.size() && isIdentifierChar(text[end]))
+                    ++end;
+
+                auto name = text.substr(i, end - i);
+                i = end;
+
+                if(name == "defined")
+                {
+                    auto parenthesis = false;
+                    while(i < text.size() && isSpace(text[i]))
+                        ++i;
+
+                    if(i < text.size() && text[i] == '(')
+                    {
+                        parenthesis = true;
+                        ++i;
+                    }
+
+                    while(i < text.size() && isSpace(text[i]))
+                        ++i;
+
+                    end = i;
+                    while(end < text.size() && isIdentifierChar(text[end]))
+                        ++end;
+
+                    auto macro = text.substr(i, end - i);
+                    i = end;
+
+                    if(parenthesis)
+                    {
+                        while(i < text.size() && isSpace(text[i]))
+                            ++i;
+
+                        if(i == text.size() || text[i] != ')')
+                            error_ = true;
+
+                        ++i;
+                    }
+
+                    if(macro.empty())
+                        error_ = true;
+                    else if(auto defined = isMacroDefined(macros_, macro))
+                        tokens_.push_back({Token::Number, *defined, {}});
+                    else
+                        tokens_.push_back({Token::Unknown, 0, {}});
+
+                    continue;
+                }
+
+                auto it = macros_.find(name);
+
+                if(it != macros_.end() && it->second.known && it->second.value)
+                    tokenize(*it->second.value, depth + 1);
+                else
+                    tokens_.push_back({Token::Unknown, 0, {}});
+
+                continue;
+            }
+
+            static const char* const operators[] = {"||", "&&", "==", "!=", "<=", ">=",
+                                                    "<<", ">>", "|", "^", "&", "<", ">",
+                                                    "+", "-", "*", "/", "%", "!", "~",
+                                                    "(", ")"};
+
+            auto found = false;
+
+            for(auto op: operators)
+            {
+                if(text.compare(i, std::strlen(op), op) == 0)
+                {
+                    tokens_.push_back({Token::Operator, 0, op});
+                    i += std::strlen(op);
+                    found = true;
+                    break;
+                }
+            }
+
+            if(!found)
+                error_ = true;
+        }
+    }
+
+    bool acceptOperator(const char* op)
+    {
+        if(pos_ < tokens_.size() && tokens_[pos_].type == Token::Operator &&
+           tokens_[pos_].op == op)
+        {
+            ++pos_;
+            return true;
+        }
+
+        return false;
+    }
+
+    Value parsePrimary()
+    {
+        if(pos_ == tokens_.size())
+        {
+            error_ = true;
+            return {};
+        }
+
+        if(acceptOperator("("))
+        {
+            auto value = parseBinary(0);
+
+            if(!acceptOperator(")"))
+                error_ = true;
+
+            return value;
+        }
+
+        for(auto op: {"!", "~", "-", "+"})
+        {
+            if(acceptOperator(op))
+            {
+                auto value = parsePrimary();
+
+                if(!value)
+                    return {};
+
+                switch(op[0])
+                {
+                    case '!': return !*value;
+                    case '~': return ~*value;
+                    case '-': return *value == LLONG_MIN ? Value() : -*value;
+                    default:  return *value;
+                }
+            }
+        }
+
+        auto& token = tokens_[pos_++];
+
+        if(token.type == Token::Number)
+            return token.value;
+
+        if(token.type == Token::Operator)
+            error_ = true;
+
+        return {};
+    }
+
+    static int getPrecedence(const std::string& op)
+    {
+        static const std::map<std::string, int> precedences =
+            {{"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5}, {"==", 6}, {"!=", 6},
+             {"<", 7}, {">", 7}, {"<=", 7}, {">=", 7}, {"<<", 8}, {">>", 8}, {"+", 9},
+             {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10}};
+
+        auto it = precedences.find(op);
+        return it == precedences.end() ? -1 : it->second;
+    }
+
+    Value parseBinary(int minPrecedence)
+    {
+        auto lhs = parsePrimary();
+
+        while(!error_ && pos_ < tokens_.size() && tokens_[pos_].type == Token::Operator)
+        {
+            auto op = tokens_[pos_].op;
+            auto precedence = getPrecedence(op);
+
+            if(precedence < minPrecedence || precedence == -1)
+                break;
+
+            ++pos_;
+            auto rhs = parseBinary(precedence + 1);
+            lhs = applyOperator(op, lhs, rhs);
+        }
+
+        return lhs;
+    }
+
+    static Value applyOperator(const std::string& op, Value lhs, Value rhs)
+    {
+        // short circuit works with one side undecidable
+        if(op == "&&")
+        {
+            if((lhs && !*lhs) || (rhs && !*rhs))
+                return 0;
+            if(lhs && rhs)
+                return 1;
+            return {};
+        }
+
+        if(op == "||")
+        {
+            if((lhs && *lhs) || (rhs && *rhs))
+                return 1;
+            if(lhs && rhs)
+                return 0;
+            return {};
+        }
+
+        if(!lhs || !rhs)
+            return {};
+
+        auto l = *lhs;
+        auto r = *rhs;
+
+        if(op == "|")  return l | r;
+        if(op == "^")  return l ^ r;
+        if(op == "&")  return l & r;
+        if(op == "==") return l == r;
+        if(op == "!=") return l != r;
+        if(op == "<")  return l < r;
+        if(op == ">")  return l > r;
+        if(op == "<=") return l <= r;
+        if(op == ">=") return l >= r;
+
+        // overflow, out of range shifts and LLONG_MIN / -1 are left for the driver
+        // (undefined behaviour or SIGFPE here)
+        if(op == "<<" || op == ">>")
+        {
+            if(r < 0 || r > 63)
+                return {};
+
+            if(op == ">>")
+                return l >> r;
+
+            if(l < 0 || l > (LLONG_MAX >> r))
+                return {};
+
+            return l << r;
+        }
+
+        long long result;
+
+        if(op == "+")
+            return __builtin_add_overflow(l, r, &result) ? Value() : result;
+
+        if(op == "-")
+            return __builtin_sub_overflow(l, r, &result) ? Value() : result;
+
+        if(op == "*")
+            return __builtin_mul_overflow(l, r, &result) ? Value() : result;
+
+        if(!r || (l == LLONG_MIN && r == -1))
+            return {};
+
+        if(op == "/")  return l / r;
+        return l % r;
+    }
+};
+
+// removes comments, inComment carries the block comment state between lines
+std::string stripComments(const std::string& line, bool& inComment)
+{
+    std::string result;
+
+    for(std::size_t i = 0; i < line.size(); ++i)
+    {
+        if(inComment)
+        {
+            if(line.compare(i, 2, "*/") == 0)
+            {
+                inComment = false;
+                ++i;
+                result += ' ';
+            }
+        }
+        else if(line.compare(i, 2, "//") == 0)
+            break;
+        else if(line.compare(i, 2, "/*") == 0)
+        {
+            inComment = true;
+            ++i;
+        }
+        else
+            result += line[i];
+    }
+
+    return result;
+}
+
+// evaluates #if, #ifdef, #ifndef, #elif, #else and #endif over the macros #defined
+// in the source, lines of branches that are never compiled are emptied (line numbers
+// are preserved), conditionals that can't be decided are left for the driver
+std::string pruneConditionals(const std::string& source)
+{
+    struct Conditional
+    {
+        enum State {Live, Dead, Unknown} state;
+        bool taken; // some previous or current branch is certainly compiled
+        bool passthrough; // directives are left for the driver
+    };
+
+    std::vector<Conditional> conditionals;
+    Macros macros;
+    ConditionEvaluator evaluator(macros);
+    std::string result;
+    result.reserve(source.size());
+
+    auto isEmitting = [&conditionals](std::size_t depth)
+    {
+        for(std::size_t i = 0; i < depth; ++i)
+        {
+            if(conditionals[i].state == Conditional::Dead)
+                return false;
+        }
+
+        return true;
+    };
+
+    auto isCertain = [&conditionals]
+    {
+        for(auto& conditional: conditionals)
+        {
+            if(conditional.state != Conditional::Live)
+                return false;
+        }
+
+        return true;
+    };
+
+    auto inComment = false;
+    std::size_t lineStart = 0;
+
+    while(lineStart < source.size())
+    {
+        auto lineEnd = std::min(source.find('\n', lineStart), source.size());
+        auto lineView = std::string_view(source).substr(lineStart, lineEnd - lineStart);
+        auto hasNewLine = lineEnd < source.size();
+        lineStart = lineEnd + 1;
+
+        // plain code, no directive and no comment
+        if(!inComment && lineView.find_first_of("#/") == std::string_view::npos)
+        {
+            if(isEmitting(conditionals.size()))
+                result += lineView;
+            if(hasNewLine)
+                result += '\n';
+            continue;
+        }
+
+        std::string line(lineView);
+        auto startsInComment = inComment;
+        auto code = stripComments(line, inComment);
+        auto first = code.find_first_not_of(" \t\r");
+        auto emit = isEmitting(conditionals.size());
+
+        auto output = [&](const std::string& text)
+        {
+            result += text;
+            if(hasNewLine)
+                result += '\n';
+        };
+
+        // a directive after a block comment ending on this line is a directive or
+        // not depending on where the comment started, left to the driver
+        if(startsInComment && first != std::string::npos && code[first] == '#')
+            return source;
+
+        if(startsInComment || first == std::string::npos || code[first] != '#')
+        {
+            output(emit ? line : "");
+            continue;
+        }
+
+        std::istringstream directiveStream(code.substr(first + 1));
+        std::string directive;
+        directiveStream >> directive;
+        std::string rest;
+        std::getline(directiveStream >> std::ws, rest);
+
+        if(directive == "if" || directive == "ifdef" || directive == "ifndef")
+        {
+            if(!emit)
+            {
+                conditionals.push_back({Conditional::Dead, true, false});
+                output("");
+                continue;
+            }
+
+            std::optional<long long> value;
+
+            if(directive == "if")
+                value = evaluator.evaluate(rest);
+            else
+            {
+                std::istringstream restStream(rest);
+                std::string name;
+                restStream >> name;
+
+                value = isMacroDefined(macros, name);
+
+                if(value && directive == "ifndef")
+                    value = !*value;
+            }
+
+            if(!value)
+            {
+                conditionals.push_back({Conditional::Unknown, false, true});
+                output(line);
+            }
+            else
+            {
+                conditionals.push_back({*value ? Conditional::Live : Conditional::Dead,
+                                        bool(*value), false});
+                output("");
+            }
+        }
+        else if((directive == "elif" || directive == "else" || directive == "endif") &&
+                conditionals.size())
+        {
+            auto& conditional = conditionals.back();
+
+            if(conditional.passthrough)
+            {
+                conditional.state = Conditional::Unknown;
+                output(line);
+            }
+            else if(directive == "endif")
+                output("");
+            else if(conditional.taken || !isEmitting(conditionals.size() - 1))
+            {
+                conditional.state = Conditional::Dead;
+                output("");
+            }
+            else if(directive == "else")
+            {
+                conditional.state = Conditional::Live;
+                conditional.taken = true;
+                output("");
+            }
+            else if(auto value = evaluator.evaluate(rest))
+            {
+                conditional.state = *value ? Conditional::Live : Conditional::Dead;
+                conditional.taken = *value;
+                output("");
+            }
+            else
+            {
+                // previous branches were dropped, this one starts the driver's chain
+                conditional.state = Conditional::Unknown;
+                conditional.passthrough = true;
+                output("#if " + rest);
+            }
+
+            if(directive == "endif")
+                conditionals.pop_back();
+        }
+        else if(!emit)
+            output("");
+        else
+        {
+            if(directive == "define" || directive == "undef")
+            {
+                std::istringstream restStream(rest);
+                std::string name;
+                restStream >> name;
+
+                auto parenthesis = name.find('(');
+                auto functionLike = parenthesis != std::string::npos;
+                name = name.substr(0, parenthesis);
+
+                if(!isCertain())
+                    macros[name] = {false, std::nullopt};
+                else if(directive == "undef")
+                    macros.erase(name);
+                else if(functionLike)
+                    macros[name] = {true, std::nullopt};
+                else
+                {
+                    std::string body;
+                    std::getline(restStream, body);
+                    macros[name] = {true, body};
+                }
+            }
+
+            output(line);
+        }
+    }
+
+    return result;
+}
+
+// inserts defines after the #version line, followed by a #line directive so the
+// driver reports the line numbers of the source
+void injectDefines(std::string& source, const Defines& defines)
+{
+    if(defines.empty())
+        return;
+
+    std::string lines;
+
+    for(auto& [name, value]: defines)
+        lines += "#define " + name + ' ' + value + '\n';
+
+    std::size_t pos = 0;
+
+    if(auto versionPos = source.find("#version"); versionPos != std::string::npos)
+        pos = std::min(source.find('\n', versionPos) + 1, source.size());
+
+    auto nextLine = std::count(source.begin(), source.begin() + pos, '\n') + 1;
+    lines += "#line " + std::to_string(nextLine) + '\n';
+
+    source.insert(pos, lines);
+}
+
+// splits source into stages, injects defines and prunes conditionals
+// does not call GL
+std::vector<StageSource> splitStages(const std::string& source, const Defines& defines)
+{
+    SH_TRACE_SCOPE("split stages", {});
+
+    struct ShaderType
+    {
+        GLenum value;
+        std::string name;
+    };
+
+    static const ShaderType shaderTypes[] = {{GL_VERTEX_SHADER,   "VERTEX"},
+                                             {GL_GEOMETRY_SHADER, "GEOMETRY"},
+                                             {GL_FRAGMENT_SHADER, "FRAGMENT"},
+                                             {GL_COMPUTE_SHADER,  "COMPUTE"}};
+    
+    struct ShaderData
+    {
+        std::size_t sourceStart;
+        const ShaderType* type;
+    };
+
+    std::vector<ShaderData> shaderData;
+
+    for(auto& shaderType: shaderTypes)
+    {
+        if(auto pos = source.find(shaderType.name); pos != std::string::npos)
+            shaderData.push_back({pos + shaderType.name.size(), &shaderType});
+    }
+
+    std::sort(shaderData.begin(), shaderData.end(),
+              [](ShaderData& l, ShaderData& r)
+              {return l.sourceStart < r.sourceStart;});
+
+    std::vector<StageSource> stages;
+
+    for(auto it = shaderData.begin(); it != shaderData.end(); ++it)
+    {
+        std::size_t count;
+        if(it == shaderData.end() - 1)
+            count = std::string::npos;
+        else
+        {
+            auto nextIt = it + 1;
+            count = nextIt->sourceStart - nextIt->type->name.size()
+                    - it->sourceStart;
+        }
+
+        auto stageSource = source.substr(it->sourceStart, count);
+        injectDefines(stageSource, defines);
+
+        if(getConditionalPruning())
+            stageSource = pruneConditionals(stageSource);
+
+        stages.push_back({it->type->value, it->type->name.c_str(),
+                          std::move(stageSource)});
+    }
+
+    return stages;
+}
+
+// on-disk cache of preprocessed sources
+// entry format (text header, numbers in decimal):
+//
+// SHSRC1
+// key
+// dependency count, then for each: path, last write time (ticks), size
+// source size, source
+// stage count, then for each: type, size, source
+
+class MappedFile
+{
+public:
+    MappedFile(const std::string& filename); // isValid() returns false on error
+    ~MappedFile();
+    MappedFile(MappedFile&& rhs);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isValid() const {return data_;}
+    const char* getData() const {return data_;}
+    std::size_t getSize() const {return size_;}
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::string buffer_; // without mmap()
+};
+
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef __unix__
+    auto fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+        return;
+
+    struct stat status;
+
+    if(::fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        auto* data = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(data != MAP_FAILED)
+        {
+            data_ = static_cast<const char*>(data);
+            size_ = status.st_size;
+            mapped_ = true;
+        }
+    }
+
+    ::close(fd);
+#else
+    std::ifstream file(filename, std::ios::binary);
+
+    if(!file.is_open())
+        return;
+
+    std::stringstream stringstream;
+    stringstream << file.rdbuf();
+    buffer_ = stringstream.str();
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef __unix__
+    if(mapped_)
+        ::munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& rhs):
+    data_(rhs.data_),
+    size_(rhs.size_),
+    mapped_(rhs.mapped_),
+    buffer_(std::move(rhs.buffer_))
+{
+    if(!mapped_ && data_)
+        data_ = buffer_.data();
+
+    rhs.data_ = nullptr;
+    rhs.mapped_ = false;
+}
+
+// files of the cache directory, shared by processes
+// entries are written to a temporary file renamed over the entry, so readers never see
+// partial entries; reads take a shared flock() on <directory>/lock, writes and eviction
+// an exclusive one (the lock file is opened per operation, so threads of one process
+// exclude each other too); reads touch the entry, eviction removes the entries with the
+// oldest last write times but never the persistent ones
+
+static const char* const compileCostsEntryName = "compile_costs";
+
+class CacheStore
+{
+public:
+    void setDirectory(const std::string& directory);
+    void setSizeLimit(std::uintmax_t bytes);
+
+    bool isEnabled();
+
+    // returns std::nullopt if the entry does not exist
+    std::optional<std::string> read(const std::string& name);
+
+    // read-only mapping (a copy where mmap() is not available), stays valid after the
+    // entry is replaced or evicted
+    std::optional<MappedFile> map(const std::string& name);
+
+    void write(const std::string& name, const std::string& data);
+
+    // read-modify-write under the exclusive lock, processes don't lose each other's
+    // updates, modify gets std::nullopt if the entry does not exist
+    void update(const std::string& name,
+                const std::function<std::string(std::optional<std::string>)>& modify);
+
+    void countHit() {++hits_; countMetric(getMetricCounters().cacheHits);}
+    void countMiss() {++misses_; countMetric(getMetricCounters().cacheMisses);}
+
+    CacheStats getStats() const;
+
+private:
+    class FileLock
+    {
+    public:
+        FileLock(const std::string& filename, bool exclusive);
+        ~FileLock();
+        FileLock(const FileLock&) = delete;
+        FileLock& operator=(const FileLock&) = delete;
+
+    private:
+        int fd_ = -1;
+    };
+
+    std::mutex mutex_;
+    std::string directory_;
+    std::uintmax_t sizeLimit_ = 0;
+    std::optional<std::uintmax_t> size_; // estimate, rescanned when above the limit
+    std::atomic<std::size_t> tmpCounter_{0};
+    std::atomic<std::size_t> hits_{0};
+    std::atomic<std::size_t> misses_{0};
+    std::atomic<std::size_t> writes_{0};
+    std::atomic<std::size_t> evictions_{0};
+
+    // returns the temporary file to rename over the entry, "" on error
+    std::string writeTemporary(const std::string& filename, const std::string& data);
+
+    // exclusive lock must be held
+    void commit(const std::string& tmpFilename, const std::string& filename,
+                std::size_t size, const std::string& directory, std::uintmax_t sizeLimit);
+
+    // exclusive lock must be held
+    void evict(const std::string& directory, std::uintmax_t sizeLimit);
+};
+
+CacheStore& getCacheStore()
+{
+    static CacheStore store;
+    return store;
+}
+
+CacheStore::FileLock::FileLock(const std::string& filename, bool exclusive)
+{
+#ifdef __unix__
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if(fd_ >= 0)
+        ::flock(fd_, exclusive ? LOCK_EX : LOCK_SH);
+#else
+    (void)filename;
+    (void)exclusive;
+#endif
+}
+
+CacheStore::FileLock::~FileLock()
+{
+#ifdef __unix__
+    if(fd_ >= 0)
+        ::close(fd_); // releases the lock
+#endif
+}
+
+void CacheStore::setDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    directory_ = directory;
+    size_.reset();
+
+    std::error_code ec;
+    if(directory.size() && !fs::create_directories(directory, ec) && ec)
+    {
+        std::cout << "sh::setCacheDirectory: could not create directory = "
+                  << directory << std::endl;
+    }
+}
+
+void CacheStore::setSizeLimit(std::uintmax_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    sizeLimit_ = bytes;
+    size_.reset();
+}
+
+bool CacheStore::isEnabled()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return directory_.size();
+}
+
+std::optional<std::string> CacheStore::read(const std::string& name)
+{
+    std::string directory;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory = directory_;
+    }
+
+    auto filename = directory + '/' + name;
+    FileLock lock(directory + "/lock", false);
+    std::ifstream file(filename, std::ios::binary);
+
+    if(!file.is_open())
+        return {};
+
+    std::stringstream stringstream;
+    stringstream << file.rdbuf();
+
+    std::error_code ec;
+    fs::last_write_time(filename, fs::file_time_type::clock::now(), ec);
+
+    return stringstream.str();
+}
+
+std::optional<MappedFile> CacheStore::map(const std::string& name)
+{
+    std::string directory;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory = directory_;
+    }
+
+    auto filename = directory + '/' + name;
+    FileLock lock(directory + "/lock", false);
+    MappedFile file(filename);
+
+    if(!file.isValid())
+        return {};
+
+    std::error_code ec;
+    fs::last_write_time(filename, fs::file_time_type::clock::now(), ec);
+
+    return file;
+}
+
+std::string CacheStore::writeTemporary(const std::string& filename, const std::string& data)
+{
+#ifdef __unix__
+    auto processId = std::to_string(::getpid());
+#else
+    std::string processId;
+#endif
+
+    auto tmpFilename = filename + '.' + processId + '.' +
+                       std::to_string(tmpCounter_++) + ".tmp";
+
+    std::ofstream file(tmpFilename, std::ios::binary);
+    file << data;
+
+    if(!file)
+    {
+        std::cout << "sh::Shader: could not write cache file = " << tmpFilename
+                  << std::endl;
+
+        file.close();
+        std::remove(tmpFilename.c_str());
+        return {};
+    }
+
+    return tmpFilename;
+}
+
+void CacheStore::commit(const std::string& tmpFilename, const std::string& filename,
+                        std::size_t size, const std::string& directory,
+                        std::uintmax_t sizeLimit)
+{
+    std::error_code ec;
+    auto replacedSize = fs::file_size(filename, ec);
+
+    if(ec)
+        replacedSize = 0;
+
+    fs::rename(tmpFilename, filename, ec);
+
+    if(ec)
+    {
+        std::remove(tmpFilename.c_str());
+        return;
+    }
+
+    ++writes_;
+
+    if(!sizeLimit || fs::path(filename).filename() == compileCostsEntryName)
+        return;
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    if(size_)
+        *size_ = *size_ + size - std::min<std::uintmax_t>(*size_ + size, replacedSize);
+
+    if(!size_ || *size_ > sizeLimit)
+        evict(directory, sizeLimit);
+}
+
+void CacheStore::write(const std::string& name, const std::string& data)
+{
+    std::string directory;
+    std::uintmax_t sizeLimit;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory = directory_;
+        sizeLimit = sizeLimit_;
+    }
+
+    auto filename = directory + '/' + name;
+    auto tmpFilename = writeTemporary(filename, data);
+
+    if(tmpFilename.empty())
+        return;
+
+    FileLock lock(directory + "/lock", true);
+    commit(tmpFilename, filename, data.size(), directory, sizeLimit);
+}
+
+void CacheStore::update(
+    const std::string& name,
+    const std::function<std::string(std::optional<std::string>)>& modify)
+{
+    std::string directory;
+    std::uintmax_t sizeLimit;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory = directory_;
+        sizeLimit = sizeLimit_;
+    }
+
+    auto filename = directory + '/' + name;
+    FileLock lock(directory + "/lock", true);
+    std::optional<std::string> data;
+
+    if(std::ifstream file(filename, std::ios::binary); file.is_open())
+    {
+        std::stringstream stringstream;
+        stringstream << file.rdbuf();
+        data = stringstream.str();
+    }
+
+    auto modified = modify(std::move(data));
+    auto tmpFilename = writeTemporary(filename, modified);
+
+    if(tmpFilename.size())
+        commit(tmpFilename, filename, modified.size(), directory, sizeLimit);
+}
+
+void CacheStore::evict(const std::string& directory, std::uintmax_t sizeLimit)
+{
+    struct Entry
+    {
+        fs::file_time_type lastWriteTime;
+        std::uintmax_t size;
+        fs::path path;
+    };
+
+    std::vector<Entry> entries;
+    std::uintmax_t size = 0;
+    auto now = fs::file_time_type::clock::now();
+    std::error_code ec;
+
+    for(fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+    {
+        auto& path = it->path();
+        std::error_code entryEc;
+
+        if(!fs::is_regular_file(it->status(entryEc)) || path.filename() == "lock")
+            continue;
+
+        // not counted, never evicted
+        if(path.filename() == compileCostsEntryName)
+            continue;
+
+        auto time = fs::last_write_time(path, entryEc);
+        auto fileSize = fs::file_size(path, entryEc);
+
+        if(entryEc)
+            continue;
+
+        // left by a crashed process
+        if(path.extension() == ".tmp")
+        {
+            if(now - time > std::chrono::hours(1))
+                fs::remove(path, entryEc);
+
+            continue;
+        }
+
+        entries.push_back({time, fileSize, path});
+        size += fileSize;
+    }
+
+    // evict down to 90% so that the next writes do not evict again
+    if(size > sizeLimit)
+    {
+        std::sort(entries.begin(), entries.end(), [](const Entry& l, const Entry& r)
+                  {return l.lastWriteTime < r.lastWriteTime;});
+
+        for(auto& entry: entries)
+        {
+            if(size <= sizeLimit / 10 * 9)
+                break;
+
+            std::error_code entryEc;
+
+            if(fs::remove(entry.path, entryEc))
+            {
+                size -= entry.size;
+                ++evictions_;
+            }
+        }
+    }
+
+    size_ = size;
+}
+
+CacheStats CacheStore::getStats() const
+{
+    return {hits_, misses_, writes_, evictions_};
+}
+
+void setCacheDirectory(const std::string& directory)
+{
+    getCacheStore().setDirectory(directory);
+}
+
+void setCacheSizeLimit(std::uintmax_t bytes)
+{
+    getCacheStore().setSizeLimit(bytes);
+}
+
+CacheStats getCacheStats()
+{
+    return getCacheStore().getStats();
+}
+
+const char* getStageName(GLenum type)
+{
+    switch(type)
+    {
+        case GL_VERTEX_SHADER:   return "VERTEX";
+        case GL_GEOMETRY_SHADER: return "GEOMETRY";
+        case GL_FRAGMENT_SHADER: return "FRAGMENT";
+        case GL_COMPUTE_SHADER:  return "COMPUTE";
+        default:                 return nullptr;
+    }
+}
+
+// filename, defines and conditional pruning setting
+std::string getSourceCacheKey(const std::string& filename, const Defines& defines)
+{
+    auto key = filename + (getConditionalPruning() ? "|pruned" : "|");
+
+    for(auto& [name, value]: defines)
+        key += '|' + name + '=' + value;
+
+    return key;
+}
+
+// last write time, or content hash for memory mounts whose time changes every run
+long long getCacheStamp(const FileStatus& status)
+{
+    if(status.contentHash)
+        return static_cast<long long>(status.contentHash);
+
+    return status.lastWriteTime.time_since_epoch().count();
+}
+
+class CacheReader
+{
+public:
+    CacheReader(std::string_view data): data_(data) {}
+
+    bool isValid() const {return valid_;}
+
+    std::string_view getLine()
+    {
+        auto pos = data_.find('\n');
+
+        if(pos == std::string_view::npos)
+        {
+            valid_ = false;
+            return {};
+        }
+
+        auto line = data_.substr(0, pos);
+        data_.remove_prefix(pos + 1);
+        return line;
+    }
+
+    long long getNumber()
+    {
+        std::string line(getLine());
+        char* end;
+        auto number = std::strtoll(line.c_str(), &end, 10);
+        valid_ = valid_ && line.size() && *end == '\0';
+        return number;
+    }
+
+    std::string_view getBytes(long long count)
+    {
+        if(count < 0 || static_cast<std::size_t>(count) > data_.size())
+        {
+            valid_ = false;
+            return {};
+        }
+
+        auto bytes = data_.substr(0, count);
+        data_.remove_prefix(count);
+        return bytes;
+    }
+
+private:
+    std::string_view data_;
+    bool valid_ = true;
+};
+
+std::optional<PreprocessedFile> loadCachedSource(const std::string& name,
+                                                 const std::string& key)
+{
+    SH_TRACE_SCOPE("source cache load", name);
+    auto data = getCacheStore().read(name);
+
+    if(!data)
+        return {};
+
+    CacheReader reader(*data);
+
+    if(reader.getLine() != "SHSRC1" || reader.getLine() != key)
+        return {};
+
+    for(auto count = reader.getNumber(); reader.isValid() && count > 0; --count)
+    {
+        std::string path(reader.getLine());
+        auto stamp = reader.getNumber();
+        auto size = reader.getNumber();
+
+        if(!reader.isValid())
+            return {};
+
+        auto status = getFileStatus(path);
+
+        if(!status || getCacheStamp(*status) != stamp ||
+           status->size != static_cast<std::uintmax_t>(size))
+        {
+            return {};
+        }
+    }
+
+    PreprocessedFile preprocessed;
+    preprocessed.source = reader.getBytes(reader.getNumber());
+
+    for(auto count = reader.getNumber(); reader.isValid() && count > 0; --count)
+    {
+        auto type = static_cast<GLenum>(reader.getNumber());
+        auto source = reader.getBytes(reader.getNumber());
+        auto* name = getStageName(type);
+
+        if(!name)
+            return {};
+
+        preprocessed.stages.push_back({type, name, std::string(source)});
+    }
+
+    if(!reader.isValid())
+        return {};
+
+    return preprocessed;
+}
+
+void storeCachedSource(const std::string& name, const std::string& key,
+                       const PreprocessedFile& preprocessed,
+                       const std::vector<SourceDependency>& dependencies)
+{
+    SH_TRACE_SCOPE("source cache store", name);
+    std::string data = "SHSRC1\n" + key + '\n' +
+                       std::to_string(dependencies.size()) + '\n';
+
+    for(auto& dependency: dependencies)
+    {
+        data += dependency.path + '\n' + std::to_string(getCacheStamp(dependency.status)) +
+                '\n' + std::to_string(dependency.status.size) + '\n';
+    }
+
+    data += std::to_string(preprocessed.source.size()) + '\n' + preprocessed.source +
+            std::to_string(preprocessed.stages.size()) + '\n';
+
+    for(auto& stage: preprocessed.stages)
+    {
+        data += std::to_string(stage.type) + '\n' + std::to_string(stage.source.size()) +
+                '\n' + stage.source;
+    }
+
+    getCacheStore().write(name, data);
+}
+
+// loadSourceFromFile() + splitStages() through the on-disk cache
+// returns std::nullopt if the file can't be read or is empty
+std::optional<PreprocessedFile> preprocessFile(const std::string& filename,
+                                               const Defines& defines)
+{
+    SH_TRACE_SCOPE("preprocess", filename);
+    auto& store = getCacheStore();
+    std::string key, cacheName;
+
+    if(store.isEnabled())
+    {
+        key = getSourceCacheKey(filename, defines);
+
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx",
+                      static_cast<unsigned long long>(hashFnv1a(key)));
+        cacheName = std::string(name) + ".src";
+
+        if(auto preprocessed = loadCachedSource(cacheName, key))
+        {
+            store.countHit();
+            return preprocessed;
+        }
+
+        store.countMiss();
+    }
+
+    std::vector<SourceDependency> dependencies;
+    auto source = loadSourceFromFile(filename, cacheName.size() ? &dependencies : nullptr);
+
+    if(source.empty())
+        return {};
+
+    PreprocessedFile preprocessed{source, splitStages(source, defines)};
+
+    if(cacheName.size())
+        storeCachedSource(cacheName, key, preprocessed, dependencies);
+
+    return preprocessed;
+}
+
+#ifdef SHADER_GLSLANG
+
+// parses every stage with glslang, thread safe, does not call GL
+bool validateSource(const std::vector<StageSource>& stages, const std::string& id)
+{
+    static std::once_flag initFlag;
+    std::call_once(initFlag, [] {glslang::InitializeProcess();});
+
+    auto valid = true;
+
+    for(auto& stage: stages)
+    {
+        EShLanguage language;
+
+        switch(stage.type)
+        {
+            case GL_VERTEX_SHADER:   language = EShLangVertex; break;
+            case GL_GEOMETRY_SHADER: language = EShLangGeometry; break;
+            case GL_FRAGMENT_SHADER: language = EShLangFragment; break;
+            default:                 language = EShLangCompute;
+        }
+
+        // glslang defaults to #version 100 (GLSL ES), the driver to 110
+        auto version = 110;
+        auto profile = ENoProfile;
+
+        if(auto pos = stage.source.find("#version"); pos != std::string::npos)
+        {
+            auto lineEnd = stage.source.find('\n', pos);
+            std::istringstream line(stage.source.substr(pos + 8, lineEnd - pos - 8));
+            std::string profileName;
+            line >> version >> profileName;
+
+            if(profileName == "es")
+                profile = EEsProfile;
+            else if(profileName == "compatibility")
+                profile = ECompatibilityProfile;
+            else if(version >= 150)
+                profile = ECoreProfile;
+        }
+
+        glslang::TShader shader(language);
+        auto* str = stage.source.c_str();
+        shader.setStrings(&str, 1);
+
+        if(!shader.parse(GetDefaultResources(), version, profile, false, false,
+                         EShMsgDefault))
+        {
+            std::cout << "sh::Shader, " << id << ": " << stage.name
+                      << " shader validation failed\n"
+                      << shader.getInfoLog() << std::endl;
+
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+#endif // SHADER_GLSLANG
+
+// issues compilation and linking without waiting for the results
+// must be completed with finishProgram()
+ProgramBuild beginProgram(const std::vector<StageSource>& stages,
+                          const std::vector<std::string>& feedbackVaryings)
+{
+    if(!isCompilationAllowed())
+    {
+        std::cout << "sh::Shader: compilation blocked by releaseShaderCompiler()"
+                  << std::endl;
+        return {};
+    }
+
+    ProgramBuild build;
+
+    for(auto& stage: stages)
+    {
+        SH_TRACE_SCOPE("compile", stage.name);
+        build.stages.push_back({createAndCompileShader(stage.type, stage.source),
+                                stage.name});
+    }
+
+    build.program = acquireProgram();
+    trackObject(GL_PROGRAM, build.program, 0);
+
+    for(auto& stage: build.stages)
+        glAttachShader(build.program, stage.shader);
+
+    if(feedbackVaryings.size())
+    {
+        std::vector<const char*> varyings;
+
+        for(auto& varying: feedbackVaryings)
+            varyings.push_back(varying.c_str());
+
+        glTransformFeedbackVaryings(build.program, varyings.size(), varyings.data(),
+                                    GL_INTERLEAVED_ATTRIBS);
+    }
+
+    if(getCacheStore().isEnabled())
+        glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    SH_TRACE_SCOPE("link", {});
+    glLinkProgram(build.program);
+
+    return build;
+}
+
+ProgramBuild beginProgram(const std::string& source, const Defines& defines,
+                          const std::vector<std::string>& feedbackVaryings)
+{
+    return beginProgram(splitStages(source, defines), feedbackVaryings);
+}
+
+// GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile
+bool hasParallelShaderCompile()
+{
+    static const auto available = []
+    {
+        GLint numExtensions;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+
+        for(GLint i = 0; i < numExtensions; ++i)
+        {
+            std::string extension =
+                reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+
+            if(extension == "GL_KHR_parallel_shader_compile" ||
+               extension == "GL_ARB_parallel_shader_compile")
+                return true;
+        }
+
+        return false;
+    }();
+
+    return available;
+}
+
+// never blocks, without parallel shader compile support always returns true
+bool isProgramBuilt(const ProgramBuild& build)
+{
+    if(!hasParallelShaderCompile())
+        return true;
+
+    static constexpr GLenum completionStatus = 0x91B1; // GL_COMPLETION_STATUS_KHR
+
+    GLint done;
+    glGetProgramiv(build.program, completionStatus, &done);
+    return done == GL_TRUE;
+}
+
+// returns 0 on error
+// when return value != 0 program must be cleaned by caller with deleteObject()
+GLuint finishProgram(ProgramBuild& build, const std::string& id)
+{
+    // waits for compilation and linking issued by beginProgram()
+    SH_TRACE_SCOPE("finish program", id);
+
+    auto compilationError = false;
+
+    for(auto& stage: build.stages)
+    {
+        if(auto error = getError<false>(stage.shader, GL_COMPILE_STATUS))
+        {
+            std::cout << "sh::Shader, " << id << ": " << stage.name
+                      << " shader compilation failed\n"
+                      << *error << std::endl;
+
+            compilationError = true;
+        }
+    }
+
+    for(auto& stage: build.stages)
+    {
+        glDetachShader(build.program, stage.shader);
+        deferDeletion(GL_SHADER, stage.shader);
+    }
+
+    auto program = build.program;
+    auto spirvSize = build.spirvSize;
+    build = {};
+
+    if(compilationError)
+    {
+        deleteObject(GL_PROGRAM, program);
+        return 0;
+    }
+
+    if(auto error = getError<true>(program, GL_LINK_STATUS))
+    {
+        std::cout << "sh::Shader, " << id << ": program linking failed\n"
+                  << *error << std::endl;
+
+        deleteObject(GL_PROGRAM, program);
+        return 0;
+    }
+
+    if(spirvSize)
+        trackObject(GL_PROGRAM, program, spirvSize);
+    else
+        trackProgramSize(program);
+
+    return program;
+}
+
+std::vector<char> loadBinaryFromFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+
+    if(!file.is_open())
+    {
+        std::cout << "sh::Shader: could not open file = " << filename << std::endl;
+        return {};
+    }
+
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+// glShaderBinary() + glSpecializeShader(), specialization errors are reported by
+// finishProgram() (GL_COMPILE_STATUS)
+// returns a build with program == 0 on error
+ProgramBuild beginSpirvProgram(const std::vector<SpirvStage>& stages,
+                               const std::string& id)
+{
+    // same signature, the core entry point is loaded only with GL 4.6
+    auto specializeShader = glSpecializeShader ? glSpecializeShader :
+                                                 glSpecializeShaderARB;
+    if(!specializeShader)
+    {
+        std::cout << "sh::Shader, " << id << ": SPIR-V requires GL 4.6 or "
+                     "GL_ARB_gl_spirv" << std::endl;
+        return {};
+    }
+
+    static constexpr std::uint32_t spirvMagic = 0x07230203;
+
+    ProgramBuild build;
+
+    for(auto& stage: stages)
+    {
+        SH_TRACE_SCOPE("specialize", stage.filename);
+        auto binary = loadBinaryFromFile(stage.filename);
+        std::uint32_t magic = 0;
+
+        if(binary.size() >= sizeof(magic))
+            std::memcpy(&magic, binary.data(), sizeof(magic));
+
+        if(magic != spirvMagic || binary.size() % 4)
+        {
+            std::cout << "sh::Shader, " << id << ": not a SPIR-V module, file = "
+                      << stage.filename << std::endl;
+
+            for(auto& built: build.stages)
+                deleteObject(GL_SHADER, built.shader);
+
+            return {};
+        }
+
+        auto shader = glCreateShader(stage.type);
+        getObjectPool().spirvObjects.insert(shader);
+        trackObject(GL_SHADER, shader, binary.size());
+        build.spirvSize += binary.size();
+        glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, binary.data(),
+                       binary.size());
+
+        std::vector<GLuint> indices, values;
+
+        for(auto& [index, value]: stage.constants)
+        {
+            indices.push_back(index);
+            values.push_back(value);
+        }
+
+        specializeShader(shader, stage.entryPoint.c_str(), indices.size(),
+                         indices.data(), values.data());
+
+        build.stages.push_back({shader, stage.filename.c_str()});
+    }
+
+    build.program = glCreateProgram();
+    getObjectPool().spirvObjects.insert(build.program);
+    trackObject(GL_PROGRAM, build.program, 0);
+
+    for(auto& stage: build.stages)
+        glAttachShader(build.program, stage.shader);
+
+    glLinkProgram(build.program);
+
+    return build;
+}
+
+// returns 0 on error
+// when return value != 0 program must be cleaned by caller with deleteObject()
+GLuint createSpirvProgram(const std::vector<SpirvStage>& stages, const std::string& id)
+{
+    auto build = beginSpirvProgram(stages, id);
+
+    if(!build.program)
+        return 0;
+
+    return finishProgram(build, id);
+}
+
+// returns 0 on error
+// when return value != 0 program must be cleaned by caller with deleteObject()
+GLuint createProgram(const std::vector<StageSource>& stages, const std::string& id,
+                     const std::vector<std::string>& feedbackVaryings)
+{
+    auto build = beginProgram(stages, feedbackVaryings);
+
+    if(!build.program)
+        return 0;
+
+    return finishProgram(build, id);
+}
+
+GLuint createProgram(const std::string& source, const std::string& id,
+                     const Defines& defines,
+                     const std::vector<std::string>& feedbackVaryings)
+{
+    return createProgram(splitStages(source, defines), id, feedbackVaryings);
+}
+
+std::string getRenderer()
+{
+    return reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+}
+
+UniformTable getUniforms(GLuint program)
+{
+    SH_TRACE_SCOPE("reflection", {});
+
+    UniformTable uniforms;
+
+    GLint numUniforms;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+
+    std::vector<char> uniformName(256);
+
+    for(int i = 0; i < numUniforms; ++i)
+    {
+        GLint size;
+        GLenum type;
+
+        glGetActiveUniform(program, i, uniformName.size(), nullptr,
+                           &size, &type, uniformName.data());
+
+        auto uniformLocation = glGetUniformLocation(program, uniformName.data());
+
+        uniforms[uniformName.data()] = {uniformLocation, type};
+    }
+
+    return uniforms;
+}
+
+// program binary cache
+// entry layout (native endianness, offsets from the start, 8-byte aligned), read through
+// mmap() so glProgramBinary() and the reflection table use the mapped pages directly:
+//
+// ProgramBinaryHeader
+// ProgramBinaryUniform[uniformCount]
+// uniform names (not null-terminated)
+// program binary
+
+struct ProgramBinaryHeader
+{
+    char magic[8]; // "SHBIN02", bumped when the layout changes
+    std::uint64_t keyHash; // second hash of the key, the first one names the entry
+    std::uint32_t binaryFormat;
+    std::uint32_t uniformCount;
+    std::uint64_t uniformsOffset;
+    std::uint64_t namesOffset;
+    std::uint64_t namesSize;
+    std::uint64_t binaryOffset;
+    std::uint64_t binarySize;
+};
+
+struct ProgramBinaryUniform
+{
+    std::uint32_t nameOffset; // from namesOffset
+    std::uint32_t nameSize;
+    std::int32_t location;
+    std::uint32_t type;
+};
+
+static constexpr char programBinaryMagic[8] = "SHBIN02";
+
+struct CachedProgram
+{
+    GLuint program;
+    UniformTable uniforms;
+};
+
+bool hasProgramBinaryFormats()
+{
+    static const auto available = []
+    {
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+    }();
+
+    return available;
+}
+
+struct ProgramCacheKey
+{
+    std::string name; // entry name, "" if the binary cache is not available
+    std::uint64_t hash;
+};
+
+// renderer, driver version, stage sources and feedback varyings
+// renderer and version, programs built by other drivers behave differently
+const std::string& getDriver()
+{
+    static const auto driver = getRenderer() + '\n' +
+                               reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    return driver;
+}
+
+ProgramCacheKey getProgramCacheKey(const std::vector<StageSource>& stages,
+                                   const std::vector<std::string>& feedbackVaryings)
+{
+    if(!getCacheStore().isEnabled() || !hasProgramBinaryFormats())
+        return {};
+
+    SH_TRACE_SCOPE("hash", "program cache key");
+    auto& driver = getDriver();
+
+    // independent seeds, the entry name and the stored hash make a 128-bit key
+    std::uint64_t nameHash = hashFnv1a(driver);
+    std::uint64_t keyHash = hashFnv1a(driver, 0x84222325cbf29ce4ull);
+
+    auto add = [&](std::string_view data)
+    {
+        nameHash = hashFnv1a(data, hashFnv1a("\n", nameHash));
+        keyHash = hashFnv1a(data, hashFnv1a("\n", keyHash));
+    };
+
+    for(auto& stage: stages)
+    {
+        add(stage.name);
+        add(stage.source);
+    }
+
+    for(auto& varying: feedbackVaryings)
+        add(varying);
+
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(nameHash));
+    return {std::string(name) + ".bin", keyHash};
+}
+
+std::optional<CachedProgram> loadProgramBinary(const ProgramCacheKey& key)
+{
+    if(key.name.empty())
+        return {};
+
+    SH_TRACE_SCOPE("binary cache load", key.name);
+
+    auto& store = getCacheStore();
+    auto file = store.map(key.name);
+
+    if(!file)
+    {
+        store.countMiss();
+        return {};
+    }
+
+    auto* data = file->getData();
+    auto size = file->getSize();
+    ProgramBinaryHeader header = {};
+
+    if(size >= sizeof(header))
+        std::memcpy(&header, data, sizeof(header));
+
+    auto inBounds = [size](std::uint64_t offset, std::uint64_t count)
+    {
+        return offset <= size && count <= size - offset;
+    };
+
+    if(std::memcmp(header.magic, programBinaryMagic, sizeof(header.magic)) ||
+       header.keyHash != key.hash ||
+       !inBounds(header.uniformsOffset,
+                 std::uint64_t(header.uniformCount) * sizeof(ProgramBinaryUniform)) ||
+       !inBounds(header.namesOffset, header.namesSize) ||
+       !inBounds(header.binaryOffset, header.binarySize))
+    {
+        store.countMiss();
+        return {};
+    }
+
+    auto program = acquireProgram();
+    trackObject(GL_PROGRAM, program, header.binarySize);
+    glProgramBinary(program, header.binaryFormat, data + header.binaryOffset,
+                    header.binarySize);
+
+    // the driver rejects binaries of other versions or configurations
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if(linked != GL_TRUE)
+    {
+        deleteObject(GL_PROGRAM, program);
+        store.countMiss();
+        return {};
+    }
+
+    CachedProgram cached{program, {}};
+    auto* uniforms = data + header.uniformsOffset;
+    auto* names = data + header.namesOffset;
+
+    for(std::uint32_t i = 0; i < header.uniformCount; ++i)
+    {
+        ProgramBinaryUniform uniform;
+        std::memcpy(&uniform, uniforms + i * sizeof(uniform), sizeof(uniform));
+
+        if(!inBounds(header.namesOffset + uniform.nameOffset, uniform.nameSize) ||
+           uniform.nameOffset + std::uint64_t(uniform.nameSize) > header.namesSize)
+        {
+            deleteObject(GL_PROGRAM, program);
+            store.countMiss();
+            return {};
+        }
+
+        cached.uniforms.emplace(std::string(names + uniform.nameOffset, uniform.nameSize),
+                                UniformInfo{uniform.location, uniform.type});
+    }
+
+    store.countHit();
+    return cached;
+}
+
+void storeProgramBinary(const ProgramCacheKey& key, GLuint program,
+                        const UniformTable& uniformTable)
+{
+    if(key.name.empty())
+        return;
+
+    SH_TRACE_SCOPE("binary cache store", key.name);
+
+    GLint binarySize = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+
+    if(binarySize <= 0)
+        return;
+
+    auto align = [](std::uint64_t offset) {return (offset + 7) / 8 * 8;};
+
+    ProgramBinaryHeader header = {};
+    std::memcpy(header.magic, programBinaryMagic, sizeof(header.magic));
+    header.keyHash = key.hash;
+    header.uniformCount = uniformTable.size();
+    header.uniformsOffset = align(sizeof(header));
+    header.namesOffset = header.uniformsOffset +
+                         header.uniformCount * sizeof(ProgramBinaryUniform);
+
+    std::vector<ProgramBinaryUniform> uniforms;
+    std::string names;
+
+    for(auto& [name, uniform]: uniformTable)
+    {
+        uniforms.push_back({static_cast<std::uint32_t>(names.size()),
+                            static_cast<std::uint32_t>(name.size()), uniform.location,
+                            uniform.type});
+        names += name;
+    }
+
+    header.namesSize = names.size();
+    header.binaryOffset = align(header.namesOffset + header.namesSize);
+
+    std::string data(header.binaryOffset + binarySize, '\0');
+    GLsizei length = 0;
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, binarySize, &length, &binaryFormat,
+                       &data[header.binaryOffset]);
+
+    if(length <= 0)
+        return;
+
+    header.binaryFormat = binaryFormat;
+    header.binarySize = length;
+    data.resize(header.binaryOffset + length);
+
+    std::memcpy(&data[0], &header, sizeof(header));
+
+    if(uniforms.size())
+    {
+        std::memcpy(&data[header.uniformsOffset], uniforms.data(),
+                    uniforms.size() * sizeof(ProgramBinaryUniform));
+    }
+
+    std::memcpy(&data[header.namesOffset], names.data(), names.size());
+
+    getCacheStore().write(key.name, data);
+}
+
+// compile cost model
+// wall times of program builds (ms) keyed by driver and stage sources, persisted in the
+// cache directory (exempt from eviction) to order the builds of the next run
+
+class CompileCosts
+{
+public:
+    CompileCosts() {getCacheStore();} // destroyed after this, save() runs at exit
+    ~CompileCosts() {save();}
+
+    std::optional<double> get(std::uint64_t key);
+    void record(std::uint64_t key, double time);
+
+    // merges with the entries written by other processes
+    void save();
+
+private:
+    std::mutex mutex_;
+    bool loaded_ = false;
+    std::map<std::uint64_t, double> costs_;
+    std::map<std::uint64_t, double> recorded_; // not saved yet
+
+    void load(std::map<std::uint64_t, double>& costs);
+};
+
+CompileCosts& getCompileCosts()
+{
+    static CompileCosts costs;
+    return costs;
+}
+
+std::uint64_t getCompileCostKey(const std::vector<StageSource>& stages,
+                                const std::vector<std::string>& feedbackVaryings)
+{
+    auto key = hashFnv1a(getDriver());
+
+    for(auto& stage: stages)
+    {
+        key = hashFnv1a(stage.name, hashFnv1a("\n", key));
+        key = hashFnv1a(stage.source, hashFnv1a("\n", key));
+    }
+
+    for(auto& varying: feedbackVaryings)
+        key = hashFnv1a(varying, hashFnv1a("\n", key));
+
+    return key;
+}
+
+void parseCompileCosts(const std::optional<std::string>& data,
+                       std::map<std::uint64_t, double>& costs)
+{
+    if(!data || data->compare(0, 8, "SHCOST1\n"))
+        return;
+
+    std::istringstream stream(data->substr(8));
+    std::string key;
+    double time;
+
+    while(stream >> key >> time)
+        costs[std::strtoull(key.c_str(), nullptr, 16)] = time;
+}
+
+void CompileCosts::load(std::map<std::uint64_t, double>& costs)
+{
+    parseCompileCosts(getCacheStore().read(compileCostsEntryName), costs);
+}
+
+std::optional<double> CompileCosts::get(std::uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(!loaded_)
+    {
+        load(costs_);
+        loaded_ = true;
+    }
+
+    auto it = costs_.find(key);
+
+    if(it == costs_.end())
+        return {};
+
+    return it->second;
+}
+
+void CompileCosts::record(std::uint64_t key, double time)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // smooths out one-off hitches
+    if(auto it = costs_.find(key); it != costs_.end())
+        time = (it->second + time) / 2.0;
+
+    costs_[key] = time;
+    recorded_[key] = time;
+}
+
+void CompileCosts::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(recorded_.empty() || !getCacheStore().isEnabled())
+        return;
+
+    getCacheStore().update(compileCostsEntryName,
+                           [this](std::optional<std::string> data)
+    {
+        std::map<std::uint64_t, double> costs;
+        parseCompileCosts(data, costs);
+
+        for(auto& [key, time]: recorded_)
+            costs[key] = time;
+
+        std::string merged = "SHCOST1\n";
+        char line[64];
+
+        for(auto& [key, time]: costs)
+        {
+            std::snprintf(line, sizeof(line), "%016llx %.3f\n",
+                          static_cast<unsigned long long>(key), time);
+            merged += line;
+        }
+
+        return merged;
+    });
+
+    recorded_.clear();
+}
+
+void saveCompileCosts()
+{
+    getCompileCosts().save();
+}
+
+bool isIdentifierChar(char c)
+{
+    return c == '_' || std::isalnum(static_cast<unsigned char>(c));
+}
+
+bool isIdentifier(const std::string& name)
+{
+    if(name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+        return false;
+
+    return std::all_of(name.begin(), name.end(), isIdentifierChar);
+}
+
+std::size_t skipSpace(const std::string& text, std::size_t pos)
+{
+    while(pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+        ++pos;
+
+    return pos;
+}
+
+std::size_t skipIdentifier(const std::string& text, std::size_t pos)
+{
+    while(pos < text.size() && isIdentifierChar(text[pos]))
+        ++pos;
+
+    return pos;
+}
+
+// start of a 'layout(...)' qualifier (and the spaces after it) ending right before pos,
+// pos if there is none
+std::size_t findLayoutBefore(const std::string& text, std::size_t pos)
+{
+    auto end = pos;
+
+    while(end && std::isspace(static_cast<unsigned char>(text[end - 1])))
+        --end;
+
+    if(!end || text[end - 1] != ')')
+        return pos;
+
+    auto open = text.rfind('(', end - 1);
+
+    if(open == std::string::npos)
+        return pos;
+
+    auto keywordEnd = open;
+
+    while(keywordEnd && std::isspace(static_cast<unsigned char>(text[keywordEnd - 1])))
+        --keywordEnd;
+
+    static const std::string layout = "layout";
+    auto start = keywordEnd - layout.size();
+
+    if(keywordEnd < layout.size() || text.compare(start, layout.size(), layout) ||
+       (start && isIdentifierChar(text[start - 1])))
+    {
+        return pos;
+    }
+
+    return start;
+}
+
+// replaces 'uniform type name;' declarations with 'const type name = value;'
+// (a token scan, a layout qualifier of the declaration is dropped with it)
+// returns empty string if a name is not an identifier or a declaration was not found
+std::string specializeSource(const std::string& source,
+                             const std::map<std::string, std::string>& specializations,
+                             const std::string& id)
+{
+    static const std::string keyword = "uniform";
+    auto result = source;
+
+    for(auto& [name, value]: specializations)
+    {
+        std::string specialized;
+        std::size_t last = 0;
+        auto found = false;
+
+        // every stage declaring the uniform
+        for(auto pos = isIdentifier(name) ? result.find(keyword) : std::string::npos;
+            pos != std::string::npos; pos = result.find(keyword, pos + 1))
+        {
+            auto keywordEnd = pos + keyword.size();
+
+            if((pos && isIdentifierChar(result[pos - 1])) ||
+               (keywordEnd < result.size() && isIdentifierChar(result[keywordEnd])))
+            {
+                continue;
+            }
+
+            auto typeStart = skipSpace(result, keywordEnd);
+            auto typeEnd = skipIdentifier(result, typeStart);
+            auto nameStart = skipSpace(result, typeEnd);
+            auto nameEnd = skipIdentifier(result, nameStart);
+            auto semicolon = skipSpace(result, nameEnd);
+
+            if(typeStart == keywordEnd || typeEnd == typeStart || nameStart == typeEnd ||
+               result.compare(nameStart, nameEnd - nameStart, name) ||
+               semicolon == result.size() || result[semicolon] != ';')
+            {
+                continue;
+            }
+
+            auto start = std::max(findLayoutBefore(result, pos), last);
+            specialized.append(result, last, start - last);
+            specialized += "const " + result.substr(typeStart, typeEnd - typeStart) +
+                           ' ' + name + " = " + value + ';';
+
+            last = semicolon + 1;
+            found = true;
+        }
+
+        if(!found)
+        {
+            std::cout << "sh::Shader, " << id << ": can't specialize uniform = "
+                      << name << std::endl;
+            return {};
+        }
+
+        specialized.append(result, last, std::string::npos);
+        result = std::move(specialized);
+    }
+
+    return result;
+}
+
+bool Shader::swapProgram(const std::string& source)
+{
+    if(spirvStages_.size())
+        return setProgram(createSpirvProgram(spirvStages_, id_), source);
+
+    return swapProgram(splitStages(source, defines_), source);
+}
+
+bool Shader::swapProgram(const std::vector<StageSource>& stages, const std::string& source)
+{
+    auto key = getProgramCacheKey(stages, feedbackVaryings_);
+
+    if(auto cached = loadProgramBinary(key))
+        return setProgram(cached->program, source, &cached->uniforms);
+
+    if(!isCompilationAllowed())
+    {
+        deferCompile(source);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto program = createProgram(stages, id_, feedbackVaryings_);
+    std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+
+    if(!setProgram(program, source))
+        return false;
+
+    countProgramBuild(time.count());
+    getCompileCosts().record(getCompileCostKey(stages, feedbackVaryings_), time.count());
+    storeProgramBinary(key, program_.getId(), uniforms_);
+    return true;
+}
+
+void Shader::deferCompile(const std::string& source)
+{
+    if(getCompilerState().mode == CompilerRelease::Defer)
+    {
+        compileDeferred_ = true;
+        deferredSource_ = source;
+        std::cout << "sh::Shader, " << id_ << ": compilation deferred" << std::endl;
+    }
+    else
+        std::cout << "sh::Shader, " << id_ << ": compilation refused" << std::endl;
+}
+
+bool Shader::swapProgramFromFile()
+{
+    auto preprocessed = preprocessFile(id_, defines_);
+
+    if(!preprocessed)
+        return false;
+
+    return swapProgram(preprocessed->stages, preprocessed->source);
+}
+
+bool Shader::setProgram(GLuint program, const std::string& source,
+                        const UniformTable* uniforms)
+{
+    if(!program)
+        return false;
+    
+    program_ = Program(program);
+    source_ = source;
+    uniforms_ = uniforms ? *uniforms : getUniforms(program_.getId());
+    inactiveUniforms_.clear();
+
+    // variants are rebuilt from the new source
+    for(auto& [key, variant]: variants_)
+    {
+        if(variant.fence)
+            glDeleteSync(variant.fence);
+
+        if(variant.build.program)
+        {
+            for(auto& stage: variant.build.stages)
+                deferDeletion(GL_SHADER, stage.shader);
+
+            deferDeletion(GL_PROGRAM, variant.build.program);
+        }
+
+        variant.program = Program();
+    }
+
+    variants_.clear();
+    variant_ = nullptr;
+    variantDirty_ = specializations_.size();
+    localSize_[0] = 0;
+    notifyProgramChanged();
+
+    return true;
+}
+
+void Shader::specialize(const std::string& uniformName, const std::string& value)
+{
+    if(spirvStages_.size())
+    {
+        std::cout << "sh::Shader, " << id_ << ": specialize() on a SPIR-V program, "
+                     "use SpirvStage::constants" << std::endl;
+        return;
+    }
+
+    specializations_[uniformName] = value;
+    variantDirty_ = true;
+}
+
+void Shader::clearSpecializations()
+{
+    specializations_.clear();
+    variant_ = nullptr;
+    variantDirty_ = false;
+    notifyProgramChanged();
+}
+
+void Shader::dispatch(GLuint sizeX, GLuint sizeY, GLuint sizeZ)
+{
+    if(!localSize_[0])
+    {
+        glGetProgramiv(program_.getId(), GL_COMPUTE_WORK_GROUP_SIZE, localSize_);
+
+        if(!localSize_[0])
+        {
+            std::cout << "sh::Shader, " << id_ << ": dispatch() on a non compute program"
+                      << std::endl;
+            return;
+        }
+    }
+
+    static const auto maxGroupCount = []
+    {
+        std::array<GLint, 3> count;
+
+        for(GLuint i = 0; i < 3; ++i)
+            glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &count[i]);
+
+        return count;
+    }();
+
+    GLuint groupCount[3] = {(sizeX + localSize_[0] - 1) / localSize_[0],
+                            (sizeY + localSize_[1] - 1) / localSize_[1],
+                            (sizeZ + localSize_[2] - 1) / localSize_[2]};
+
+    for(int i = 0; i < 3; ++i)
+    {
+        if(groupCount[i] > static_cast<GLuint>(maxGroupCount[i]))
+        {
+            std::cout << "sh::Shader, " << id_ << ": dispatch() of " << groupCount[i]
+                      << " work groups over the limit " << maxGroupCount[i] << std::endl;
+
+            countMetric(getMetricCounters().dispatchesRejected);
+            return;
+        }
+    }
+
+    glDispatchCompute(groupCount[0], groupCount[1], groupCount[2]);
+}
+
+bool Shader::updateVariant()
+{
+    auto changed = false;
+
+    if(variantDirty_)
+    {
+        variantDirty_ = false;
+        variant_ = nullptr;
+        changed = true;
+
+        std::string key;
+
+        for(auto& [name, value]: specializations_)
+            key += name + '=' + value + ';';
+
+        if(auto it = variants_.find(key); it != variants_.end())
+            variant_ = &it->second;
+        else if(!isCompilationAllowed())
+        {
+            // generic program meanwhile
+            variantDirty_ = getCompilerState().mode == CompilerRelease::Defer;
+            return true;
+        }
+        else
+        {
+            variant_ = &variants_[key];
+
+            if(auto source = specializeSource(source_, specializations_, id_);
+               source.size())
+            {
+                variant_->build = beginProgram(source, defines_, feedbackVaryings_);
+
+                // the build can't be polled, the fence signals once the gpu is past it
+                if(variant_->build.program && !hasParallelShaderCompile())
+                {
+                    variant_->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    glFlush();
+                }
+            }
+        }
+    }
+
+    if(!variant_ || !variant_->build.program)
+        return changed;
+
+    if(variant_->fence)
+    {
+        if(glClientWaitSync(variant_->fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return changed;
+
+        glDeleteSync(variant_->fence);
+        variant_->fence = nullptr;
+    }
+    else if(!isProgramBuilt(variant_->build))
+        return changed;
+
+    if(auto program = finishProgram(variant_->build, id_ + " (specialized)"))
+    {
+        variant_->program = Program(program);
+        variant_->uniforms = getUniforms(program);
+        return true;
+    }
+
+    return changed;
+}
+
+bool Shader::setFeedbackVaryings(const std::vector<std::string>& varyings)
+{
+    if(spirvStages_.size())
+    {
+        std::cout << "sh::Shader, " << id_ << ": setFeedbackVaryings() on a SPIR-V "
+                     "program, use xfb_* layout qualifiers" << std::endl;
+        return false;
+    }
+
+    auto prevVaryings = std::move(feedbackVaryings_);
+    feedbackVaryings_ = varyings;
+
+    if(swapProgram(source_))
+        return true;
+
+    feedbackVaryings_ = std::move(prevVaryings);
+    return false;
+}
+
+ShaderLibrary::LoadStats ShaderLibrary::loadDirectory(const std::string& path,
+                                                      const std::string& pattern,
+                                                      bool hotReload,
+                                                      const Defines& defines)
+{
+    SH_TRACE_SCOPE("load directory", path);
+    using Clock = std::chrono::steady_clock;
+    using Ms = std::chrono::duration<double, std::milli>;
+
+    auto start = Clock::now();
+    std::vector<std::string> filenames;
+
+    for(auto& filename: listDirectory(path, pattern))
+    {
+        if(!shaders_.count(filename))
+            filenames.push_back(filename);
+    }
+
+    struct Job
+    {
+        Defines defines;
+        fs::file_time_type fileLastWriteTime;
+        std::string source;
+        std::vector<StageSource> stages;
+        std::uint64_t hash;
+    };
+
+    std::vector<Job> jobs(filenames.size());
+
+    for(std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        jobs[i].defines = addTunedWorkGroupSize(filenames[i], defines);
+
+        pool_.submit([&job = jobs[i], &filename = filenames[i]]
+        {
+            job.fileLastWriteTime = getFileLastWriteTime(filename);
+
+            if(auto preprocessed = preprocessFile(filename, job.defines))
+            {
+                job.source = std::move(preprocessed->source);
+                job.stages = std::move(preprocessed->stages);
+            }
+
+            SH_TRACE_SCOPE("hash", filename);
+            job.hash = hashFnv1a({});
+
+            for(auto& stage: job.stages)
+            {
+                job.hash = hashFnv1a(stage.name, job.hash);
+                job.hash = hashFnv1a(stage.source, job.hash);
+            }
+        });
+    }
+
+    pool_.wait();
+    auto preprocessed = Clock::now();
+
+    std::vector<ProgramCacheKey> keys;
+    std::vector<std::optional<CachedProgram>> cachedPrograms;
+    std::vector<std::uint64_t> costKeys(jobs.size());
+    std::vector<double> costs(jobs.size()); // predicted, then measured
+    std::vector<std::size_t> order;         // of the jobs to build
+    double knownTime = 0.0;
+    std::size_t knownSize = 0;
+    LoadStats stats;
+
+    for(std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto& job = jobs[i];
+        keys.push_back(job.source.size() ? getProgramCacheKey(job.stages, {}) :
+                                           ProgramCacheKey());
+        cachedPrograms.push_back(loadProgramBinary(keys.back()));
+
+        if(job.source.empty() || cachedPrograms.back() || !isCompilationAllowed())
+            continue;
+
+        costKeys[i] = getCompileCostKey(job.stages, {});
+        order.push_back(i);
+
+        if(auto cost = getCompileCosts().get(costKeys[i]))
+        {
+            costs[i] = *cost;
+            knownTime += *cost;
+            knownSize += job.source.size();
+            ++stats.knownCostCount;
+        }
+        else
+            costs[i] = -1.0;
+    }
+
+    // unknown costs are estimated from the source size
+    auto timePerByte = knownSize ? knownTime / knownSize : 1.0;
+
+    for(auto i: order)
+    {
+        if(costs[i] < 0.0)
+            costs[i] = jobs[i].source.size() * timePerByte;
+    }
+
+    // longest processing time first, the most expensive builds start first and overlap
+    // with the rest when the driver compiles in parallel
+    std::stable_sort(order.begin(), order.end(),
+                     [&costs](std::size_t lhs, std::size_t rhs)
+                     {return costs[lhs] > costs[rhs];});
+
+    std::vector<ProgramBuild> builds(jobs.size());
+
+    for(auto i: order)
+    {
+        auto buildStart = Clock::now();
+        builds[i] = beginProgram(jobs[i].stages, {});
+        costs[i] = Ms(Clock::now() - buildStart).count();
+    }
+
+    // with parallel shader compile a build compiles in the background while earlier ones
+    // are waited for, so its wait depends on the issue order and would teach the model
+    // the order it just used; such builds are not recorded (Shader builds, which are
+    // measured alone, still are)
+    auto overlapped = hasParallelShaderCompile();
+    std::vector<GLuint> programs(jobs.size(), 0);
+
+    for(auto i: order)
+    {
+        if(!builds[i].program)
+            continue;
+
+        auto finishStart = Clock::now();
+        programs[i] = finishProgram(builds[i], filenames[i]);
+        costs[i] += Ms(Clock::now() - finishStart).count();
+
+        if(!programs[i])
+            continue;
+
+        countProgramBuild(costs[i]);
+
+        if(!overlapped)
+            getCompileCosts().record(costKeys[i], costs[i]);
+    }
+
+    for(std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto program = programs[i];
+        const UniformTable* uniforms = nullptr;
+
+        if(cachedPrograms[i])
+        {
+            program = cachedPrograms[i]->program;
+            uniforms = &cachedPrograms[i]->uniforms;
+        }
+
+        auto& entry = shaders_[filenames[i]];
+        entry.shader.reset(new Shader(filenames[i], hotReload, jobs[i].defines,
+                                      jobs[i].fileLastWriteTime, jobs[i].source, program,
+                                      uniforms));
+        entry.hash = jobs[i].hash;
+
+        if(entry.shader->isValid() && !cachedPrograms[i])
+        {
+            storeProgramBinary(keys[i], entry.shader->program_.getId(),
+                               entry.shader->uniforms_);
+        }
+        else if(jobs[i].source.size() && !cachedPrograms[i] && !isCompilationAllowed())
+            entry.shader->deferCompile(jobs[i].source);
+
+        stats.validCount += entry.shader->isValid();
+    }
+
+    getCompileCosts().save();
+
+    stats.fileCount = jobs.size();
+    stats.preprocessTime = Ms(preprocessed - start).count();
+    stats.compileTime = Ms(Clock::now() - preprocessed).count();
+    return stats;
+}
+
+Shader* ShaderLibrary::get(const std::string& filename)
+{
+    auto it = shaders_.find(filename);
+    return it == shaders_.end() ? nullptr : it->second.shader.get();
+}
+
+std::uint64_t ShaderLibrary::getHash(const std::string& filename) const
+{
+    auto it = shaders_.find(filename);
+    return it == shaders_.end() ? 0 : it->second.hash;
+}
+
+FeedbackCapture captureFeedback(GLenum drawMode, GLsizei vertexCount,
+                                GLenum primitiveMode, std::size_t bufferSize)
+{
+    // failures are told by the preconditions and the primitive count, glGetError()
+    // would also report (and clear) the errors of the application
+    GLint program = 0;
+    GLint varyingCount = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+
+    if(program)
+        glGetProgramiv(program, GL_TRANSFORM_FEEDBACK_VARYINGS, &varyingCount);
+
+    if(!varyingCount || !bufferSize || vertexCount <= 0)
+    {
+        std::cout << "sh::captureFeedback: nothing to capture (bound program without "
+                     "feedback varyings or empty buffer)" << std::endl;
+        return {};
+    }
+
+    // restored after the capture
+    GLint previousBuffer = 0;
+    GLint previousIndexedBuffer = 0;
+    GLint64 previousStart = 0;
+    GLint64 previousSize = 0;
+    auto rasterizerDiscard = glIsEnabled(GL_RASTERIZER_DISCARD);
+    glGetIntegerv(GL_TRANSFORM_FEEDBACK_BUFFER_BINDING, &previousBuffer);
+    glGetIntegeri_v(GL_TRANSFORM_FEEDBACK_BUFFER_BINDING, 0, &previousIndexedBuffer);
+    glGetInteger64i_v(GL_TRANSFORM_FEEDBACK_BUFFER_START, 0, &previousStart);
+    glGetInteger64i_v(GL_TRANSFORM_FEEDBACK_BUFFER_SIZE, 0, &previousSize);
+
+    FeedbackCapture capture;
+    glGenBuffers(1, &capture.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, capture.buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, bufferSize, nullptr, GL_STATIC_DRAW);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, capture.buffer);
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+    glBeginTransformFeedback(primitiveMode);
+    glDrawArrays(drawMode, 0, vertexCount);
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+    if(!rasterizerDiscard)
+        glDisable(GL_RASTERIZER_DISCARD);
+
+    if(previousSize)
+    {
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, previousIndexedBuffer,
+                          previousStart, previousSize);
+    }
+    else
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, previousIndexedBuffer);
+
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, previousBuffer);
+
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT, &capture.primitiveCount);
+    glDeleteQueries(1, &query);
+
+    // a draw or primitive mode rejected by glBeginTransformFeedback() writes nothing
+    if(!capture.primitiveCount)
+    {
+        std::cout << "sh::captureFeedback: no primitive captured" << std::endl;
+        glDeleteBuffers(1, &capture.buffer);
+        return {};
+    }
+
+    GLsizei verticesPerPrimitive = 1;
+
+    if(primitiveMode == GL_LINES)
+        verticesPerPrimitive = 2;
+    else if(primitiveMode == GL_TRIANGLES)
+        verticesPerPrimitive = 3;
+
+    capture.vertexCount = capture.primitiveCount * verticesPerPrimitive;
+    return capture;
+}
+
+std::string getDefinesKey(const Defines& defines)
+{
+    std::string key;
+
+    for(auto& [name, value]: defines)
+        key += name + '=' + value + ';';
+
+    return key;
+}
+
+// tuning cache file: one 'renderer \t name \t result' line per entry
+std::optional<std::string> loadTuningResult(const std::string& cacheFilename,
+                                            const std::string& name)
+{
+    std::ifstream file(cacheFilename);
+    auto renderer = getRenderer();
+    std::string line;
+
+    while(std::getline(file, line))
+    {
+        auto first = line.find('\t');
+        auto second = line.find('\t', first + 1);
+
+        if(second == std::string::npos)
+            continue;
+
+        if(line.compare(0, first, renderer) == 0 &&
+           line.compare(first + 1, second - first - 1, name) == 0)
+            return line.substr(second + 1);
+    }
+
+    return {};
+}
+
+void storeTuningResult(const std::string& cacheFilename, const std::string& name,
+                       const std::string& result)
+{
+    auto entryPrefix = getRenderer() + '\t' + name + '\t';
+    std::string content;
+
+    {
+        std::ifstream file(cacheFilename);
+        std::string line;
+
+        while(std::getline(file, line))
+        {
+            if(line.compare(0, entryPrefix.size(), entryPrefix) != 0)
+                content += line + '\n';
+        }
+    }
+
+    std::ofstream file(cacheFilename, std::ios::trunc);
+    file << content << entryPrefix << result << '\n';
+
+    if(!file)
+    {
+        std::cout << "sh::tuneVariants: could not write file = " << cacheFilename
+                  << std::endl;
+    }
+}
+
+int tuneVariants(const std::string& filename, const std::vector<Defines>& variants,
+                 const std::function<void(Shader&)>& draw,
+                 const std::string& cacheFilename, int iterations)
+{
+    if(auto result = loadTuningResult(cacheFilename, filename))
+    {
+        for(std::size_t i = 0; i < variants.size(); ++i)
+        {
+            if(getDefinesKey(variants[i]) == *result)
+                return i;
+        }
+    }
+
+    struct Result
+    {
+        std::size_t variant;
+        GLuint64 gpuTime;
+        GLuint64 cpuTime;
+    };
+
+    std::vector<Result> results;
+    auto gpuTimerValid = true;
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    for(std::size_t i = 0; i < variants.size(); ++i)
+    {
+        Shader shader(filename, false, variants[i]);
+
+        if(!shader.isValid())
+            continue;
+
+        auto& rejected = getMetricCounters().dispatchesRejected;
+        auto rejectedBefore = rejected.load(std::memory_order_relaxed);
+
+        // warm-up, drivers may finish compilation on first use
+        shader.bind();
+        draw(shader);
+        glFinish();
+
+        if(rejected.load(std::memory_order_relaxed) != rejectedBefore)
+        {
+            std::cout << "sh::tuneVariants, " << filename << ": variant "
+                      << getDefinesKey(variants[i]) << " failed" << std::endl;
+            continue;
+        }
+
+        Result result{i, 0, 0};
+
+        for(auto it = 0; it < iterations; ++it)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            shader.bind();
+            draw(shader);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 gpuTime;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpuTime);
+            glFinish();
+
+            GLuint64 cpuTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now() - start).count();
+
+            // some software renderers report nonsense (e.g. for compute dispatches)
+            if(!gpuTime || gpuTime > cpuTime)
+                gpuTimerValid = false;
+
+            if(it == 0 || gpuTime < result.gpuTime)
+                result.gpuTime = gpuTime;
+
+            if(it == 0 || cpuTime < result.cpuTime)
+                result.cpuTime = cpuTime;
+        }
+
+        results.push_back(result);
+    }
+
+    if(!gpuTimerValid)
+    {
+        std::cout << "sh::tuneVariants, " << filename
+                  << ": timer queries unreliable, using cpu time" << std::endl;
+    }
+
+    auto best = -1;
+    GLuint64 bestTime = 0;
+
+    for(auto& result: results)
+    {
+        auto time = gpuTimerValid ? result.gpuTime : result.cpuTime;
+
+        std::cout << "sh::tuneVariants, " << filename << ": variant "
+                  << getDefinesKey(variants[result.variant]) << " " << time / 1000
+                  << " us" << std::endl;
+
+        if(best == -1 || time < bestTime)
+        {
+            best = result.variant;
+            bestTime = time;
+        }
+    }
+
+    glDeleteQueries(1, &query);
+
+    if(best != -1)
+        storeTuningResult(cacheFilename, filename, getDefinesKey(variants[best]));
+
+    return best;
+}
+
+Defines getWorkGroupDefines(const WorkGroupSize& size)
+{
+    return {{"LOCAL_SIZE_X", std::to_string(size.x)},
+            {"LOCAL_SIZE_Y", std::to_string(size.y)},
+            {"LOCAL_SIZE_Z", std::to_string(size.z)}};
+}
+
+struct TunedWorkGroupSizes
+{
+    std::mutex mutex;
+    std::map<std::string, WorkGroupSize> sizes; // key: filename
+};
+
+TunedWorkGroupSizes& getTunedWorkGroupSizes()
+{
+    static TunedWorkGroupSizes tuned;
+    return tuned;
+}
+
+// defines passed by the user win
+Defines addTunedWorkGroupSize(const std::string& filename, const Defines& defines)
+{
+    auto& tuned = getTunedWorkGroupSizes();
+    std::lock_guard<std::mutex> lock(tuned.mutex);
+
+    if(tuned.sizes.empty())
+        return defines;
+
+    auto size = tuned.sizes.find(filename);
+
+    if(size == tuned.sizes.end())
+        return defines;
+
+    for(auto& define: defines)
+    {
+        if(define.first == "LOCAL_SIZE_X")
+            return defines;
+    }
+
+    auto result = defines;
+
+    for(auto& define: getWorkGroupDefines(size->second))
+        result.push_back(std::move(define));
+
+    return result;
+}
+
+WorkGroupSize tuneWorkGroupSize(const std::string& filename,
+                                const std::vector<WorkGroupSize>& candidates,
+                                const std::function<void(Shader&)>& dispatch,
+                                const std::string& cacheFilename, int iterations)
+{
+    std::vector<Defines> variants;
+
+    for(auto& candidate: candidates)
+        variants.push_back(getWorkGroupDefines(candidate));
+
+    auto best = tuneVariants(filename, variants, dispatch, cacheFilename, iterations);
+
+    if(best == -1)
+        return {0, 0, 0};
+
+    auto& tuned = getTunedWorkGroupSizes();
+    std::lock_guard<std::mutex> lock(tuned.mutex);
+    tuned.sizes[filename] = candidates[best];
+    return candidates[best];
 }
 
 } // namespace sh
@@ -0,0 +1,147 @@
+// ShaderLibrary::loadDirectory() scaling over thread counts
+// usage: bench [shader count] (default 1000)
+// writes a synthetic corpus to bench_corpus/
+
+#include "glad.h"
+#define SHADER_IMPLEMENTATION
+#include "Shader.hpp"
+
+#include <GLFW/glfw3.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static const char* corpusDirectory = "bench_corpus";
+static const int includeCount = 50;
+
+static void writeFile(const std::string& filename, const std::string& contents)
+{
+    std::ofstream file(filename);
+    file << contents;
+}
+
+static void writeCorpus(int shaderCount)
+{
+    sh::fs::create_directories(std::string(corpusDirectory) + "/include");
+
+    std::string common = "#define LIGHT_COUNT 4\n";
+
+    for(int i = 0; i < 40; ++i)
+    {
+        common += "float common" + std::to_string(i) + "(float x) {return x * " +
+                  std::to_string(i) + ".0 + sin(x);}\n";
+    }
+
+    writeFile(std::string(corpusDirectory) + "/include/common.glsl", common);
+
+    for(int i = 0; i < includeCount; ++i)
+    {
+        std::string include = "INCLUDE \"" + std::string(corpusDirectory) +
+                              "/include/common.glsl\"\n";
+
+        for(int j = 0; j < 20; ++j)
+        {
+            include += "#if LIGHT_COUNT > " + std::to_string(j % 8) + "\n"
+                       "vec3 light" + std::to_string(j) + "(vec3 n) {return n * common" +
+                       std::to_string(j) + "(n.x);}\n"
+                       "#else\n"
+                       "vec3 light" + std::to_string(j) + "(vec3 n) {return n;}\n"
+                       "#endif\n";
+        }
+
+        writeFile(std::string(corpusDirectory) + "/include/lib" + std::to_string(i) +
+                  ".glsl", include);
+    }
+
+    for(int i = 0; i < shaderCount; ++i)
+    {
+        auto include = "INCLUDE \"" + std::string(corpusDirectory) + "/include/lib" +
+                       std::to_string(i % includeCount) + ".glsl\"\n";
+
+        std::string shader = "VERTEX\n"
+                             "#version 330\n"
+                             "layout(location = 0) in vec3 position;\n"
+                             "out vec3 normal;\n"
+                             "void main()\n"
+                             "{\n"
+                             "    normal = position;\n"
+                             "    gl_Position = vec4(position, 1.0);\n"
+                             "}\n"
+                             "FRAGMENT\n"
+                             "#version 330\n" + include +
+                             "in vec3 normal;\n"
+                             "out vec4 color;\n"
+                             "void main()\n"
+                             "{\n"
+                             "#ifdef SHADOWS\n"
+                             "    color = vec4(light" + std::to_string(i % 20) +
+                             "(normal) * 0.5, 1.0);\n"
+                             "#else\n"
+                             "    color = vec4(light" + std::to_string(i % 20) +
+                             "(normal), " + std::to_string(i) + ".0);\n"
+                             "#endif\n"
+                             "}\n";
+
+        writeFile(std::string(corpusDirectory) + "/shader" + std::to_string(i) + ".sh",
+                  shader);
+    }
+}
+
+static void error_callback(int error, const char* description)
+{
+    (void)error;
+    fprintf(stderr, "Error: %s\n", description);
+}
+
+int main(int argc, char** argv)
+{
+    auto shaderCount = argc > 1 ? atoi(argv[1]) : 1000;
+
+    glfwSetErrorCallback(error_callback);
+    if (!glfwInit())
+        exit(EXIT_FAILURE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    auto window = glfwCreateWindow(64, 64, "bench", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    glfwMakeContextCurrent(window);
+    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+
+    writeCorpus(shaderCount);
+
+    auto coreCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<int> threadCounts;
+
+    for(int threadCount = 1; threadCount < coreCount; threadCount *= 2)
+        threadCounts.push_back(threadCount);
+
+    threadCounts.push_back(coreCount);
+
+    printf("%d shaders, %d cores\n", shaderCount, coreCount);
+    printf("threads  preprocess (ms)  speedup  compile (ms)  valid\n");
+
+    double baseTime = 0.0;
+
+    for(auto threadCount: threadCounts)
+    {
+        sh::ShaderLibrary library(threadCount);
+        auto stats = library.loadDirectory(corpusDirectory, "*.sh", false,
+                                           {{"SHADOWS", ""}});
+        if(!baseTime)
+            baseTime = stats.preprocessTime;
+
+        printf("%7d  %15.1f  %7.2f  %12.1f  %zu/%zu\n", threadCount,
+               stats.preprocessTime, baseTime / stats.preprocessTime, stats.compileTime,
+               stats.validCount, stats.fileCount);
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    exit(EXIT_SUCCESS);
+}
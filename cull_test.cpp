@@ -0,0 +1,189 @@
+// GpuCuller::cull() against the cpu reference cullInstances()
+// usage: cull_test [instance count] (default 10000), needs GL 4.3
+// returns 1 if the results differ
+
+#include "glad.h"
+#define SHADER_IMPLEMENTATION
+#include "GpuCuller.hpp"
+
+#include <GLFW/glfw3.h>
+#include "linmath.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static const GLuint commandCount = 16;
+
+static void error_callback(int error, const char* description)
+{
+    (void)error;
+    fprintf(stderr, "Error: %s\n", description);
+}
+
+static GLuint createBuffer(const void* data, std::size_t size)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_COPY);
+    return buffer;
+}
+
+// visibleIdCount < instanceCount exercises the capacity clamp
+static bool compare(sh::GpuCuller& culler, const float (&planes)[6][4],
+                    const std::vector<sh::GpuCuller::Instance>& instances,
+                    const std::vector<sh::DrawElementsIndirectCommand>& commands,
+                    GLuint visibleIdCount)
+{
+    auto instanceCount = static_cast<GLuint>(instances.size());
+
+    auto cpuCommands = commands;
+    std::vector<GLuint> cpuIds(visibleIdCount);
+    sh::cullInstances(planes, instances.data(), instanceCount, cpuCommands.data(),
+                      commandCount, cpuIds.data(), visibleIdCount);
+
+    GLuint buffers[3] =
+    {
+        createBuffer(instances.data(), instances.size() * sizeof(instances[0])),
+        createBuffer(commands.data(), commands.size() * sizeof(commands[0])),
+        createBuffer(nullptr, visibleIdCount * sizeof(GLuint))
+    };
+
+    culler.cull(planes, buffers[0], instanceCount, buffers[1], commandCount, buffers[2]);
+
+    auto gpuCommands = commands;
+    std::vector<GLuint> gpuIds(visibleIdCount);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                       gpuCommands.size() * sizeof(gpuCommands[0]), gpuCommands.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[2]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuIds.size() * sizeof(GLuint),
+                       gpuIds.data());
+    glDeleteBuffers(3, buffers);
+
+    auto visibleCount = 0u;
+
+    for(GLuint i = 0; i < commandCount; ++i)
+    {
+        auto& cpu = cpuCommands[i];
+        auto& gpu = gpuCommands[i];
+
+        if(cpu.instanceCount != gpu.instanceCount)
+        {
+            printf("command %u: cpu instanceCount = %u, gpu instanceCount = %u\n", i,
+                   cpu.instanceCount, gpu.instanceCount);
+            return false;
+        }
+
+        if(!gpu.instanceCount)
+            continue;
+
+        // the gpu writes the ids of a command in any order and, when the capacity is
+        // exceeded, keeps any subset of them
+        auto first = gpuIds.begin() + gpu.baseInstance;
+        auto last = first + gpu.instanceCount;
+        std::sort(first, last);
+
+        auto sameIds = visibleIdCount < instanceCount ||
+                       std::equal(first, last, cpuIds.begin() + cpu.baseInstance);
+
+        auto sameCommand = std::all_of(first, last, [&](GLuint id)
+                                       {return instances[id].drawId == i;});
+
+        if(!sameIds || !sameCommand)
+        {
+            printf("command %u: visible ids differ\n", i);
+            return false;
+        }
+
+        visibleCount += gpu.instanceCount;
+    }
+
+    printf("%u instances, %u visible ids, capacity %u: ok\n", instanceCount, visibleCount,
+           visibleIdCount);
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    auto instanceCount = argc > 1 ? static_cast<GLuint>(atoi(argv[1])) : 10000u;
+
+    glfwSetErrorCallback(error_callback);
+    if (!glfwInit())
+        exit(EXIT_FAILURE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    auto window = glfwCreateWindow(64, 64, "cull_test", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    glfwMakeContextCurrent(window);
+    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+
+    sh::GpuCuller culler;
+
+    if(!culler.isValid())
+    {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+
+    mat4x4 view, projection, mvp;
+    vec3 eye = {0.f, 0.f, 0.f}, center = {0.f, 0.f, -1.f}, up = {0.f, 1.f, 0.f};
+    mat4x4_look_at(view, eye, center, up);
+    mat4x4_perspective(projection, 1.f, 1.f, 0.1f, 100.f);
+    mat4x4_mul(mvp, projection, view);
+
+    float planes[6][4];
+    sh::extractFrustumPlanes(&mvp[0][0], planes);
+
+    // every 97th instance has an out of range drawId and must be skipped
+    srand(1);
+    std::vector<sh::GpuCuller::Instance> instances(instanceCount);
+
+    for(GLuint i = 0; i < instanceCount; ++i)
+    {
+        auto& instance = instances[i];
+
+        for(auto& value: instance.center)
+            value = rand() / (float) RAND_MAX * 200.f - 100.f;
+
+        instance.radius = rand() / (float) RAND_MAX * 5.f;
+        instance.drawId = i % 97 ? i % commandCount : commandCount + i;
+    }
+
+    std::vector<GLuint> commandSizes(commandCount);
+
+    for(auto& instance: instances)
+    {
+        if(instance.drawId < commandCount)
+            ++commandSizes[instance.drawId];
+    }
+
+    std::vector<sh::DrawElementsIndirectCommand> commands(commandCount);
+    GLuint baseInstance = 0;
+
+    for(GLuint i = 0; i < commandCount; ++i)
+    {
+        commands[i] = {3, 0, 0, 0, baseInstance};
+        baseInstance += commandSizes[i];
+    }
+
+    auto success = compare(culler, planes, instances, commands, instanceCount) &&
+                   compare(culler, planes, instances, commands, instanceCount / 3);
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        printf("GL error\n");
+        success = false;
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
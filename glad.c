@@ -16,6 +16,12 @@
         --profile="core" --api="gl=4.5" --generator="c" --spec="gl" --no-loader --extensions=""
     Online:
         http://glad.dav1d.de/#profile=core&language=c&specification=gl&api=gl%3D4.5
+
+    Not regenerated since: the GL 4.6 core additions (glSpecializeShader,
+    glMultiDrawArraysIndirectCount, glMultiDrawElementsIndirectCount,
+    glPolygonOffsetClamp and the 4.6 enums) and GL_ARB_gl_spirv
+    (glSpecializeShaderARB) were added by hand, in the layout glad generates
+    for --api="gl=4.6" --extensions="GL_ARB_gl_spirv".
 */
 
 #include <stdio.h>
@@ -129,6 +135,7 @@ int GLAD_GL_VERSION_4_2;
 int GLAD_GL_VERSION_4_3;
 int GLAD_GL_VERSION_4_4;
 int GLAD_GL_VERSION_4_5;
+int GLAD_GL_VERSION_4_6;
 PFNGLCOPYTEXIMAGE1DPROC glad_glCopyTexImage1D;
 PFNGLVERTEXATTRIBI3UIPROC glad_glVertexAttribI3ui;
 PFNGLVERTEXARRAYELEMENTBUFFERPROC glad_glVertexArrayElementBuffer;
@@ -195,6 +202,12 @@ PFNGLPROGRAMUNIFORM1UIPROC glad_glProgramUniform1ui;
 PFNGLBLENDEQUATIONSEPARATEIPROC glad_glBlendEquationSeparatei;
 PFNGLGETNMAPIVPROC glad_glGetnMapiv;
 PFNGLTEXTUREBARRIERPROC glad_glTextureBarrier;
+PFNGLSPECIALIZESHADERPROC glad_glSpecializeShader;
+PFNGLMULTIDRAWARRAYSINDIRECTCOUNTPROC glad_glMultiDrawArraysIndirectCount;
+PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC glad_glMultiDrawElementsIndirectCount;
+PFNGLPOLYGONOFFSETCLAMPPROC glad_glPolygonOffsetClamp;
+int GLAD_GL_ARB_gl_spirv;
+PFNGLSPECIALIZESHADERARBPROC glad_glSpecializeShaderARB;
 PFNGLUNIFORM3DPROC glad_glUniform3d;
 PFNGLUNIFORM3FPROC glad_glUniform3f;
 PFNGLVERTEXATTRIB4UBVPROC glad_glVertexAttrib4ubv;
@@ -1575,9 +1588,20 @@ static void load_GL_VERSION_4_5(GLADloadproc load) {
 	glad_glGetnMinmax = (PFNGLGETNMINMAXPROC)load("glGetnMinmax");
 	glad_glTextureBarrier = (PFNGLTEXTUREBARRIERPROC)load("glTextureBarrier");
 }
+static void load_GL_VERSION_4_6(GLADloadproc load) {
+	if(!GLAD_GL_VERSION_4_6) return;
+	glad_glSpecializeShader = (PFNGLSPECIALIZESHADERPROC)load("glSpecializeShader");
+	glad_glMultiDrawArraysIndirectCount = (PFNGLMULTIDRAWARRAYSINDIRECTCOUNTPROC)load("glMultiDrawArraysIndirectCount");
+	glad_glMultiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC)load("glMultiDrawElementsIndirectCount");
+	glad_glPolygonOffsetClamp = (PFNGLPOLYGONOFFSETCLAMPPROC)load("glPolygonOffsetClamp");
+}
+static void load_GL_ARB_gl_spirv(GLADloadproc load) {
+	if(!GLAD_GL_ARB_gl_spirv) return;
+	glad_glSpecializeShaderARB = (PFNGLSPECIALIZESHADERARBPROC)load("glSpecializeShaderARB");
+}
 static int find_extensionsGL(void) {
 	if (!get_exts()) return 0;
-	(void)&has_ext;
+	GLAD_GL_ARB_gl_spirv = has_ext("GL_ARB_gl_spirv");
 	free_exts();
 	return 1;
 }
@@ -1636,9 +1660,10 @@ static void find_coreGL(void) {
 	GLAD_GL_VERSION_4_3 = (major == 4 && minor >= 3) || major > 4;
 	GLAD_GL_VERSION_4_4 = (major == 4 && minor >= 4) || major > 4;
 	GLAD_GL_VERSION_4_5 = (major == 4 && minor >= 5) || major > 4;
-	if (GLVersion.major > 4 || (GLVersion.major >= 4 && GLVersion.minor >= 5)) {
+	GLAD_GL_VERSION_4_6 = (major == 4 && minor >= 6) || major > 4;
+	if (GLVersion.major > 4 || (GLVersion.major >= 4 && GLVersion.minor >= 6)) {
 		max_loaded_major = 4;
-		max_loaded_minor = 5;
+		max_loaded_minor = 6;
 	}
 }
 
@@ -1666,8 +1691,10 @@ int gladLoadGLLoader(GLADloadproc load) {
 	load_GL_VERSION_4_3(load);
 	load_GL_VERSION_4_4(load);
 	load_GL_VERSION_4_5(load);
+	load_GL_VERSION_4_6(load);
 
 	if (!find_extensionsGL()) return 0;
+	load_GL_ARB_gl_spirv(load);
 	return GLVersion.major != 0 || GLVersion.minor != 0;
 }
 
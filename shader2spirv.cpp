@@ -0,0 +1,139 @@
+// offline compiler of .sh sources to SPIR-V modules loadable with sh::SpirvStage
+// usage: shader2spirv <input.sh> <output prefix> [NAME=VALUE ...]
+// writes <output prefix>.vert.spv, .geom.spv, .frag.spv or .comp.spv
+//
+// runs glslangValidator (must be in PATH) in OpenGL SPIR-V mode (-G), so the sources
+// must follow GL_ARB_gl_spirv rules, e.g. explicit locations for uniforms and varyings
+
+#define SHADER_IMPLEMENTATION
+#include "glad.h"
+#include "Shader.hpp"
+
+#include <cstdlib>
+#include <cstdio>
+
+#ifdef __unix__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// runs glslangValidator without a shell, returns its exit status, -1 if it could not run
+static int compileToSpirv(std::string glslFilename, std::string spirvFilename)
+{
+    // not taken for options
+    for(auto* filename: {&glslFilename, &spirvFilename})
+    {
+        if(filename->size() && (*filename)[0] == '-')
+            *filename = "./" + *filename;
+    }
+
+#ifdef __unix__
+    auto pid = fork();
+
+    if(pid == -1)
+        return -1;
+
+    if(pid == 0)
+    {
+        execlp("glslangValidator", "glslangValidator", "-G", "-o", spirvFilename.c_str(),
+               glslFilename.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    int status;
+
+    if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status))
+        return -1;
+
+    return WEXITSTATUS(status);
+#else
+    // the command line goes through the shell, quotes can't be escaped
+    if(glslFilename.find('"') != std::string::npos ||
+       spirvFilename.find('"') != std::string::npos)
+    {
+        std::cout << "shader2spirv: quotes in file names are not supported" << std::endl;
+        return -1;
+    }
+
+    auto command = "glslangValidator -G -o \"" + spirvFilename + "\" \"" +
+                   glslFilename + '"';
+
+    return std::system(command.c_str());
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        std::cout << "usage: shader2spirv <input.sh> <output prefix> [NAME=VALUE ...]"
+                  << std::endl;
+        return 1;
+    }
+
+    sh::Defines defines;
+
+    for(int i = 3; i < argc; ++i)
+    {
+        std::string define = argv[i];
+        auto pos = define.find('=');
+
+        if(pos == std::string::npos)
+            defines.push_back({define, ""});
+        else
+            defines.push_back({define.substr(0, pos), define.substr(pos + 1)});
+    }
+
+    auto source = sh::loadSourceFromFile(argv[1]);
+
+    if(source.empty())
+        return 1;
+
+    std::string prefix = argv[2];
+    auto stages = sh::splitStages(source, defines);
+
+    if(stages.empty())
+    {
+        std::cout << "shader2spirv: no stages in file = " << argv[1] << std::endl;
+        return 1;
+    }
+
+    for(auto& stage: stages)
+    {
+        const char* extension;
+
+        switch(stage.type)
+        {
+            case GL_VERTEX_SHADER:   extension = "vert"; break;
+            case GL_GEOMETRY_SHADER: extension = "geom"; break;
+            case GL_FRAGMENT_SHADER: extension = "frag"; break;
+            default:                 extension = "comp";
+        }
+
+        auto glslFilename = prefix + '.' + extension;
+        auto spirvFilename = glslFilename + ".spv";
+
+        {
+            std::ofstream file(glslFilename);
+            file << stage.source;
+
+            if(!file)
+            {
+                std::cout << "shader2spirv: could not write file = " << glslFilename
+                          << std::endl;
+                return 1;
+            }
+        }
+
+        auto status = compileToSpirv(glslFilename, spirvFilename);
+        std::remove(glslFilename.c_str());
+
+        if(status)
+        {
+            std::cout << "shader2spirv: " << stage.name << " stage failed" << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "glad.h"
 #define SHADER_IMPLEMENTATION
 #include "Shader.hpp"
+#include "MeshBuffer.hpp"
+#include "FramePacer.hpp"
 
 #include <GLFW/glfw3.h>
 #include "linmath.h"
@@ -16,6 +18,7 @@ static const struct
     {  0.6f, -0.4f, 0.f, 1.f, 0.f },
     {   0.f,  0.6f, 0.f, 0.f, 1.f }
 };
+static const GLuint indices[3] = {0, 1, 2};
 
 static void error_callback(int error, const char* description)
 {
@@ -32,7 +35,7 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 int main(void)
 {
     GLFWwindow* window;
-    GLuint vertex_buffer, vao;
+    GLuint vao;
     GLint mvp_location;
     glfwSetErrorCallback(error_callback);
     if (!glfwInit())
@@ -54,9 +57,10 @@ int main(void)
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
     glfwSwapInterval(1);
 
-    glGenBuffers(1, &vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    sh::setDeferredDeletion(true);
+
+    sh::MeshBuffer meshBuffer(sizeof(vertices[0]), 1024, 1024);
+    auto triangle = meshBuffer.add(vertices, 3, indices, 3);
 
     sh::Shader shader("my_shader.sh", true);
 
@@ -68,6 +72,7 @@ int main(void)
 
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
+    meshBuffer.bind();
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
                           sizeof(float) * 5, (void*) 0);
@@ -75,10 +80,15 @@ int main(void)
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
                           sizeof(float) * 5, (void*) (sizeof(float) * 2));
 
+    sh::FramePacer framePacer(2);
+
     auto prevTime = glfwGetTime();
 
     while (!glfwWindowShouldClose(window))
     {
+        framePacer.beginFrame();
+        glfwPollEvents();
+
         auto newTime = glfwGetTime();
         auto frameTime = newTime - prevTime;
         prevTime = newTime;
@@ -99,9 +109,10 @@ int main(void)
         mat4x4_ortho(p, -ratio, ratio, -1.f, 1.f, 1.f, -1.f);
         mat4x4_mul(mvp, p, m);
         glUniformMatrix4fv(mvp_location, 1, GL_FALSE, (const GLfloat*) mvp);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
+        meshBuffer.draw(triangle);
+        sh::processDeferredDeletions();
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        framePacer.endFrame();
     }
     glfwDestroyWindow(window);
     glfwTerminate();
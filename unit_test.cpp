@@ -0,0 +1,441 @@
+// checks of the parts that don't need a GL context
+// usage: unit_test, returns the number of failed checks
+// writes unit_test_output/
+
+#include "glad.h"
+#define SHADER_IMPLEMENTATION
+#define SHADER_TRACE
+#include "Shader.hpp"
+#include "MeshBuffer.hpp"
+
+#include <stdio.h>
+
+static const char* outputDirectory = "unit_test_output";
+static int failCount = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char* text, int line)
+{
+    if(condition)
+        return;
+
+    printf("unit_test.cpp:%d: check failed: %s\n", line, text);
+    ++failCount;
+}
+
+static void writeFile(const std::string& filename, const std::string& contents)
+{
+    std::ofstream file(filename, std::ios::binary);
+    file << contents;
+}
+
+static void testRangeAllocator()
+{
+    sh::RangeAllocator allocator(100);
+
+    auto a = allocator.allocate(10);
+    auto b = allocator.allocate(20, 16);
+    auto c = allocator.allocate(30);
+
+    CHECK(a == 0);
+    CHECK(b == 16);
+    CHECK(c == 36);
+    CHECK(allocator.getFreeSize() == 40);
+    CHECK(allocator.allocate(0) == sh::RangeAllocator::invalid);
+    CHECK(allocator.allocate(101) == sh::RangeAllocator::invalid);
+
+    // neighbours coalesce back into a single free range
+    allocator.free(a);
+    allocator.free(c);
+    allocator.free(b);
+    CHECK(allocator.getFreeSize() == 100);
+    CHECK(allocator.allocate(100) == 0);
+    allocator.free(0);
+
+    // alignment 0 is treated as 1
+    CHECK(allocator.allocate(5) == 0);
+    CHECK(allocator.allocate(5, 0) == 5);
+
+    // invalid free is reported and ignored
+    allocator.free(3);
+    CHECK(allocator.getFreeSize() == 90);
+}
+
+static void testPruneConditionals()
+{
+    auto pruned = sh::pruneConditionals("#define A 2\n"
+                                        "#if A > 1 && defined(A)\n"
+                                        "live\n"
+                                        "#else\n"
+                                        "dead\n"
+                                        "#endif\n"
+                                        "#ifdef GL_ES\n"
+                                        "driver\n"
+                                        "#endif\n");
+
+    CHECK(pruned.find("live") != std::string::npos);
+    CHECK(pruned.find("dead") == std::string::npos);
+    CHECK(pruned.find("#ifdef GL_ES\ndriver\n#endif") != std::string::npos);
+
+    // line numbers are preserved
+    CHECK(std::count(pruned.begin(), pruned.end(), '\n') == 9);
+
+    // overflow, out of range shifts and division traps are left for the driver
+    const char* undecidable[] =
+    {
+        "#if (-9223372036854775807 - 1) / -1\n",
+        "#if (-9223372036854775807 - 1) % -1\n",
+        "#if 1 << 70\n",
+        "#if 1 << -1\n",
+        "#if 9223372036854775807 + 1\n",
+        "#if -9223372036854775807 - 2\n",
+        "#if 4611686018427387904 * 2\n",
+        "#if -(-9223372036854775807 - 1)\n",
+        "#if 99999999999999999999\n"
+    };
+
+    for(auto condition: undecidable)
+    {
+        auto source = condition + std::string("a\n#else\nb\n#endif\n");
+        CHECK(sh::pruneConditionals(source) == source);
+    }
+
+    CHECK(sh::pruneConditionals("#if 1 << 62 > 0\na\n#endif\n") == "\na\n\n");
+
+    // a directive after a multi-line comment is not lost
+    std::string commented = "#if 0\n/* c\n*/ #endif\ny\n";
+    CHECK(sh::pruneConditionals(commented) == commented);
+
+    // opt-in
+    auto stages = sh::splitStages("VERTEX\n#version 330\n#if 0\nx\n#endif\n", {});
+    CHECK(stages.size() == 1 && stages[0].source.find('x') != std::string::npos);
+
+    sh::setConditionalPruning(true);
+    stages = sh::splitStages("VERTEX\n#version 330\n#if 0\nx\n#endif\n", {});
+    CHECK(stages.size() == 1 && stages[0].source.find('x') == std::string::npos);
+    sh::setConditionalPruning(false);
+}
+
+static void testInjectDefines()
+{
+    std::string source = "\n#version 330\nvoid main() {}\n";
+    sh::injectDefines(source, {{"A", "1"}, {"B", "x y"}});
+
+    CHECK(source == "\n#version 330\n#define A 1\n#define B x y\n#line 3\n"
+                    "void main() {}\n");
+}
+
+static void testSpecializeSource()
+{
+    std::string source = "VERTEX\nuniform float scale;\nuniform vec4 x;\n"
+                         "FRAGMENT\nlayout(location = 2) uniform float scale ;\n";
+
+    auto specialized = sh::specializeSource(source, {{"scale", "$1 * 2.0"}}, "unit_test");
+
+    CHECK(specialized == "VERTEX\nconst float scale = $1 * 2.0;\nuniform vec4 x;\n"
+                         "FRAGMENT\nconst float scale = $1 * 2.0;\n");
+
+    // whole tokens only
+    auto tokens = sh::specializeSource("uniform float scaleX;\nmyuniform float scale;\n"
+                                       "uniform  float\tscale\n;", {{"scale", "1.0"}},
+                                       "unit_test");
+
+    CHECK(tokens == "uniform float scaleX;\nmyuniform float scale;\n"
+                    "const float scale = 1.0;");
+
+    // not identifiers, must be rejected without throwing
+    CHECK(sh::specializeSource(source, {{"planes[0", "1.0"}}, "unit_test").empty());
+    CHECK(sh::specializeSource(source, {{"f(", "1.0"}}, "unit_test").empty());
+    CHECK(sh::specializeSource(source, {{"x.y", "1.0"}}, "unit_test").empty());
+    CHECK(sh::specializeSource(source, {{"missing", "1.0"}}, "unit_test").empty());
+}
+
+static void testPack()
+{
+    sh::mountMemory("pack_src/a.glsl", "float a;\n");
+    sh::mountMemory("pack_src/b.glsl", std::string("binary\0\n\nnewlines", 17));
+
+    auto packFilename = std::string(outputDirectory) + "/test.pack";
+    CHECK(sh::writePack(packFilename, {"pack_src/a.glsl", "pack_src/b.glsl"}));
+
+    sh::clearMounts();
+    CHECK(sh::mountPack("pack", packFilename));
+
+    auto a = sh::readFile("pack/pack_src/a.glsl");
+    auto b = sh::readFile("pack/pack_src/b.glsl");
+
+    CHECK(a && *a == "float a;\n");
+    CHECK(b && *b == std::string("binary\0\n\nnewlines", 17));
+    CHECK(!sh::readFile("pack/pack_src/c.glsl"));
+
+    // later mounts overlay earlier ones
+    auto overlayFilename = std::string(outputDirectory) + "/overlay.pack";
+    writeFile(overlayFilename, "SHPACK1\npack_src/a.glsl\n9\nfloat b;\n");
+    CHECK(sh::mountPack("pack", overlayFilename));
+
+    a = sh::readFile("pack/pack_src/a.glsl");
+    b = sh::readFile("pack/pack_src/b.glsl");
+    CHECK(a && *a == "float b;\n");
+    CHECK(b && b->size() == 17);
+
+    sh::clearMounts();
+
+    // a missing input fails, an empty pack is valid
+    CHECK(!sh::writePack(packFilename, {"pack_src/missing.glsl"}));
+    CHECK(sh::writePack(packFilename, {}));
+    CHECK(sh::mountPack("pack", packFilename));
+
+    sh::clearMounts();
+
+    // truncated or corrupt packs must be rejected, not loop or read out of bounds
+    const char* corruptPacks[] =
+    {
+        "SHPACK1\nnolf",
+        "SHPACK1\npath\n4",
+        "SHPACK1\npath\nsize\nabcd",
+        "SHPACK1\npath\n-1\nabcd",
+        "SHPACK1\npath\n4x\nabcd",
+        "SHPACK1\npath\n10\nabcd",
+        "SHPACK1\npath\n2\nabcd"
+    };
+
+    for(auto corruptPack: corruptPacks)
+    {
+        writeFile(packFilename, corruptPack);
+        CHECK(!sh::mountPack("pack", packFilename));
+        CHECK(!sh::readFile("pack/path"));
+    }
+
+    sh::clearMounts();
+}
+
+// preprocessFile() hits and misses
+static void testSourceCache()
+{
+    auto cacheDirectory = std::string(outputDirectory) + "/source_cache";
+    sh::fs::remove_all(cacheDirectory);
+    sh::setCacheDirectory(cacheDirectory);
+
+    auto preprocess = [](bool hit)
+    {
+        auto hits = sh::getCacheStats().hits;
+        auto preprocessed = sh::preprocessFile("cache_src/main.sh", {{"N", "4"}});
+        CHECK((sh::getCacheStats().hits == hits + 1) == hit);
+        return preprocessed;
+    };
+
+    sh::mountMemory("cache_src/main.sh", "VERTEX\n#version 330\n"
+                                         "INCLUDE \"cache_src/inc.glsl\"\n");
+    sh::mountMemory("cache_src/inc.glsl", "float a;\n");
+
+    auto miss = preprocess(false);
+    auto hit = preprocess(true);
+
+    CHECK(miss && hit && miss->source == hit->source);
+    CHECK(hit->stages.size() == 1 && hit->stages[0].source == miss->stages[0].source);
+    CHECK(hit->stages[0].source.find("#define N 4") != std::string::npos);
+
+    // memory mounts are keyed by contents, not by the time they were mounted
+    sh::mountMemory("cache_src/inc.glsl", "float a;\n");
+    preprocess(true);
+    sh::mountMemory("cache_src/inc.glsl", "float b;\n");
+    auto changed = preprocess(false);
+    CHECK(changed && changed->source.find("float b;") != std::string::npos);
+
+    // pack mounts are keyed by the time of the pack
+    auto packFilename = std::string(outputDirectory) + "/cache.pack";
+    CHECK(sh::writePack(packFilename, {"cache_src/main.sh", "cache_src/inc.glsl"}));
+
+    sh::clearMounts();
+    CHECK(sh::mountPack("", packFilename));
+    preprocess(false);
+    preprocess(true);
+
+    sh::clearMounts();
+    CHECK(sh::mountPack("", packFilename));
+    preprocess(true);
+
+    sh::clearMounts();
+    sh::setCacheDirectory("");
+}
+
+static void testCacheEviction()
+{
+    auto cacheDirectory = std::string(outputDirectory) + "/eviction_cache";
+    sh::fs::remove_all(cacheDirectory);
+    sh::setCacheDirectory(cacheDirectory);
+    sh::setCacheSizeLimit(1000);
+
+    auto& store = sh::getCacheStore();
+    auto evictions = sh::getCacheStats().evictions;
+    std::string entry(300, 'x');
+
+    // file times are too coarse to order back to back writes
+    auto setAge = [&](const char* name, int seconds)
+    {
+        sh::fs::last_write_time(cacheDirectory + '/' + name,
+                                sh::fs::file_time_type::clock::now() -
+                                std::chrono::seconds(seconds));
+    };
+
+    store.write("a", entry);
+    store.write("b", entry);
+    store.write("c", entry);
+    setAge("a", 30);
+    setAge("b", 20);
+    setAge("c", 10);
+
+    // replacing an entry does not grow the size, compile costs are not counted
+    store.write("c", entry);
+    store.write("c", entry);
+    store.write(sh::compileCostsEntryName, std::string(2000, 'x'));
+    CHECK(sh::getCacheStats().evictions == evictions);
+
+    // a read makes an entry the most recently used
+    CHECK(store.read("a").has_value());
+    store.write("d", entry);
+
+    CHECK(sh::getCacheStats().evictions == evictions + 1);
+    CHECK(store.read("a") && !store.read("b") && store.read("c") && store.read("d"));
+    CHECK(store.read(sh::compileCostsEntryName).has_value());
+
+    sh::setCacheSizeLimit(0);
+    sh::setCacheDirectory("");
+}
+
+static void testCompileCosts()
+{
+    std::map<std::uint64_t, double> costs;
+    sh::parseCompileCosts(std::string("SHCOST1\n00000000000000ff 1.500\n"
+                                      "000000000000000a 2\ntruncated"), costs);
+
+    CHECK(costs.size() == 2 && costs[0xff] == 1.5 && costs[0xa] == 2.0);
+
+    costs.clear();
+    sh::parseCompileCosts(std::string("SHCOST2\n00000000000000ff 1.5\n"), costs);
+    sh::parseCompileCosts(std::nullopt, costs);
+    CHECK(costs.empty());
+
+    auto cacheDirectory = std::string(outputDirectory) + "/cost_cache";
+    sh::fs::remove_all(cacheDirectory);
+    sh::setCacheDirectory(cacheDirectory);
+
+    // a time measured again is averaged
+    auto& compileCosts = sh::getCompileCosts();
+    compileCosts.record(1, 10.0);
+    compileCosts.record(1, 20.0);
+    CHECK(compileCosts.get(1) == 15.0);
+
+    // save() merges with the entries written by other processes
+    auto& store = sh::getCacheStore();
+    store.write(sh::compileCostsEntryName,
+                "SHCOST1\n0000000000000002 7.000\n0000000000000001 99.000\n");
+    sh::saveCompileCosts();
+
+    sh::parseCompileCosts(store.read(sh::compileCostsEntryName), costs);
+    CHECK(costs.size() == 2 && costs[1] == 15.0 && costs[2] == 7.0);
+
+    sh::setCacheDirectory("");
+}
+
+static void testTrace()
+{
+    CHECK(sh::escapeJson("a\"b\\c") == "a\\\"b\\\\c");
+    CHECK(sh::escapeJson("\n\t\x01\x1f") == "\\u000a\\u0009\\u0001\\u001f");
+    CHECK(sh::escapeJson("\x7f\xc3\xa9 ") == "\x7f\xc3\xa9 ");
+
+    auto traceFilename = std::string(outputDirectory) + "/trace.json";
+    CHECK(sh::startTrace(traceFilename));
+    CHECK(!sh::startTrace(traceFilename));
+
+    {
+        sh::TraceScope scope("unit \"test\"", "path\\with \"quotes\"\nand a newline");
+    }
+
+    CHECK(sh::stopTrace());
+    CHECK(!sh::stopTrace());
+
+    auto trace = sh::readFile(traceFilename);
+    CHECK(trace && trace->find("\"name\":\"unit \\\"test\\\"\"") != std::string::npos);
+    CHECK(trace && trace->find("\"detail\":\"path\\\\with \\\"quotes\\\"\\u000aand a "
+                               "newline\"") != std::string::npos);
+}
+
+static void testThreadPool()
+{
+    sh::ThreadPool pool(3);
+    CHECK(pool.getThreadCount() == 3);
+
+    std::atomic<int> sum{0};
+
+    // tasks submitted by tasks are waited for too
+    for(int i = 1; i <= 100; ++i)
+    {
+        pool.submit([&pool, &sum, i]
+        {
+            sum += i;
+            pool.submit([&sum] {++sum;});
+        });
+    }
+
+    pool.wait();
+    CHECK(sum == 5050 + 100);
+
+    // wait() with nothing submitted returns
+    pool.wait();
+
+    std::vector<int> values(1000);
+    sh::parallelFor(values.size(), [&values](std::size_t i) {values[i] = i * 2;});
+
+    for(std::size_t i = 0; i < values.size(); ++i)
+        CHECK(values[i] == static_cast<int>(i * 2));
+}
+
+static void testFixedString()
+{
+    static constexpr sh::FixedString version = "#version 330\n";
+    static constexpr auto source = version + "#define N 4\n" +
+                                   sh::FixedString("void main() {}\n");
+
+    static_assert(source.size() == 13 + 12 + 15);
+    static_assert(source.data[source.size()] == '\0');
+
+    CHECK(std::string_view(source) == "#version 330\n#define N 4\nvoid main() {}\n");
+    CHECK(std::string(source.c_str()) == std::string(std::string_view(source)));
+
+    // a literal on the left, empty operands
+    static constexpr auto stages = "VERTEX\n" + source + sh::FixedString("") +
+                                   "FRAGMENT\n" + version + "";
+
+    static_assert(stages.size() == 7 + source.size() + 9 + version.size());
+
+    // stages are still split at runtime, as the Shader constructor does
+    auto split = sh::splitStages(std::string(stages.data, stages.size()), {});
+
+    CHECK(split.size() == 2 && split[0].type == GL_VERTEX_SHADER &&
+          split[1].type == GL_FRAGMENT_SHADER);
+    CHECK(split.size() == 2 && split[0].source.find("#define N 4") != std::string::npos);
+}
+
+int main()
+{
+    sh::fs::create_directories(outputDirectory);
+
+    testRangeAllocator();
+    testPruneConditionals();
+    testInjectDefines();
+    testSpecializeSource();
+    testPack();
+    testSourceCache();
+    testCacheEviction();
+    testCompileCosts();
+    testTrace();
+    testThreadPool();
+    testFixedString();
+
+    if(!failCount)
+        printf("unit_test: all checks passed\n");
+
+    return failCount;
+}